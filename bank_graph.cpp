@@ -0,0 +1,126 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Reads sound banks from the ROM in a graph of instruments
+ */
+
+#include "bank_graph.hpp"
+
+// Read the header of a sample, only the first time it's used
+SampleHeader BankGraph::read_sample(uint32_t pointer)
+{
+	SampleHeader *found = samples.find(pointer);
+	if (found) return *found;
+
+	SampleHeader s = SampleHeader();
+	s.pointer = pointer;
+	try
+	{
+		s.loop = rom.u32(pointer);
+		s.pitch = rom.u32(pointer + 4);
+		s.loop_pos = rom.u32(pointer + 8);
+		s.len = rom.u32(pointer + 12);
+		s.valid = true;
+
+		// Golden Sun synth parameters
+		if (s.len == 0 && s.loop_pos == 0)
+			for (int i = 0; i < 4 && pointer + 16 + i < rom.size(); i++)
+				s.synth[i] = rom.u8(pointer + 16 + i);
+	}
+	catch (...)
+	{}
+	samples.insert(pointer, s);
+	return s;
+}
+
+// Read the sub-instruments of a key split or every key split instrument,
+// only the first time they're used
+const std::vector<GraphInstrument> *BankGraph::read_subs(const GraphInstrument& instr)
+{
+	uint32_t base_pointer = instr.inst.word1 & 0x3ffffff;
+	// Every key split instruments have no key table
+	uint32_t key_table = instr.type() == 0x40 ? instr.inst.word2 & 0x3ffffff : 0xffffffff;
+
+	std::pair<uint32_t, uint32_t> key(base_pointer, key_table);
+	std::map<std::pair<uint32_t, uint32_t>, std::vector<GraphInstrument> >::iterator it = sub_tables.find(key);
+	if (it != sub_tables.end()) return &it->second;
+
+	std::vector<GraphInstrument> subs(128, GraphInstrument());
+	for (int k = 0; k < 128; k++)
+		subs[k].address = base_pointer + 12*k;
+
+	if (instr.type() == 0x40)
+	{
+		// Read the sub-instruments used at least once in the key table
+		for (int k = 0; k < 128; k++)
+		{
+			uint8_t index = instr.data[k];
+			if (index & 0x80) continue;		// Ignore entries with MSB set (invalid)
+			if (!subs[index].valid)
+				subs[index] = read_instrument(base_pointer + 12*index, true);
+		}
+	}
+	else
+	{
+		for (int k = 0; k < 128; k++)
+			subs[k] = read_instrument(base_pointer + 12*k, true);
+	}
+	return &(sub_tables[key] = subs);
+}
+
+// Read an instrument and what it points to, sub-instruments don't have sub-instruments of their own
+GraphInstrument BankGraph::read_instrument(uint32_t address, bool sub)
+{
+	GraphInstrument instr = GraphInstrument();
+	instr.address = address;
+	try
+	{
+		instr.inst = read_inst_data(rom, address);
+	}
+	catch (...)
+	{
+		return instr;
+	}
+	instr.valid = true;
+
+	uint8_t type = instr.type();
+	uint32_t pointer = instr.inst.word1 & 0x3ffffff;
+	try
+	{
+		// Sampled instruments, sub-instruments of every key split instruments are sampled
+		// if the low bits of their type are clear
+		if ((type & 0x07) == 0 && (sub || type < 0x40))
+			instr.sample = read_sample(pointer);
+
+		// GameBoy channel 3 instruments
+		else if ((type & 0x07) == 3)
+			instr.data = rom.at(pointer, 16);
+
+		// Key split instruments
+		else if (type == 0x40 && !sub)
+		{
+			instr.data = rom.at(instr.inst.word2 & 0x3ffffff, 128);
+			instr.subs = read_subs(instr);
+		}
+
+		// Every key split instruments
+		else if (type == 0x80 && !sub)
+			instr.subs = read_subs(instr);
+	}
+	catch (...)
+	{}
+	return instr;
+}
+
+const GraphBank& BankGraph::add_bank(uint32_t address, unsigned int ninstr)
+{
+	std::map<uint32_t, GraphBank>::iterator it = banks.find(address);
+	if (it != banks.end()) return it->second;
+
+	GraphBank& bank = banks[address];
+	bank.address = address;
+	for (unsigned int i = 0; i < ninstr; i++)
+		bank.instruments.push_back(read_instrument(address + 12*i, false));
+	return bank;
+}
@@ -0,0 +1,125 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Sound banks of a GBA game read from the ROM once: their instruments, the key tables and
+ * sub-instruments of key split instruments, and the headers of the samples they use.
+ * Both the verbose output and the SF2 builders work from this graph.
+ * It's only read once built, so it can be shared by builders on several threads.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+#include "data_view.hpp"
+#include "hash_map.hpp"
+
+struct inst_data
+{
+	uint32_t word0;
+	uint32_t word1;
+	uint32_t word2;
+
+	bool operator ==(const inst_data& i) const
+	{
+		return word0 == i.word0 && word1 == i.word1 && word2 == i.word2;
+	}
+};
+
+// Read the 12 bytes of an instrument, throws -1 if they aren't within the ROM
+static inline inst_data read_inst_data(const DataView& rom, uint32_t address)
+{
+	inst_data inst = {rom.u32(address), rom.u32(address + 4), rom.u32(address + 8)};
+	return inst;
+}
+
+// Header of a sample within the ROM
+struct SampleHeader
+{
+	bool valid;				// false if it isn't within the ROM
+	uint32_t pointer;
+	uint32_t loop;			// 0x40000000 if looped, 0 if not, 1 if BDPCM compressed
+	uint32_t pitch;			// 1024 * frequency of middle C
+	uint32_t loop_pos;
+	uint32_t len;
+	uint8_t synth[4];		// Golden Sun synth parameters, after the header when len and loop_pos are 0 (all 0 if not within the ROM)
+
+	bool loop_flag() const
+	{
+		return loop >> 24 == 0x40;
+	}
+};
+
+// An instrument of a bank, or a sub-instrument of a key split instrument
+struct GraphInstrument
+{
+	bool valid;				// false if it isn't within the ROM
+	uint32_t address;
+	inst_data inst;
+	SampleHeader sample;	// Sample of sampled instruments
+	const uint8_t *data;	// Key table (128 bytes) of key split instruments, wave (16 bytes) of GameBoy channel 3 instruments,
+							// nullptr if they aren't within the ROM
+	// Sub-instruments: by index for key split instruments (only the ones the key table uses are valid),
+	// by key for every key split instruments, nullptr for other instruments
+	const std::vector<GraphInstrument> *subs;
+
+	uint8_t type() const
+	{
+		return inst.word0 & 0xff;
+	}
+
+	bool unused() const
+	{
+		return inst.word0 == 0x3c01 && inst.word1 == 0x02 && inst.word2 == 0x0F0000;
+	}
+};
+
+struct GraphBank
+{
+	uint32_t address;
+	std::vector<GraphInstrument> instruments;
+};
+
+class BankGraph
+{
+	struct PointerHash
+	{
+		uint32_t operator ()(uint32_t p) const
+		{
+			return hash_mix(p);
+		}
+	};
+
+	DataView rom;
+	std::map<uint32_t, GraphBank> banks;
+	// Sub-instrument tables, shared by the instruments using them, by (instrument table, key table)
+	std::map<std::pair<uint32_t, uint32_t>, std::vector<GraphInstrument> > sub_tables;
+	// Sample headers already read
+	OpenHashMap<uint32_t, SampleHeader, PointerHash> samples;
+
+	SampleHeader read_sample(uint32_t pointer);
+	GraphInstrument read_instrument(uint32_t address, bool sub);
+	const std::vector<GraphInstrument> *read_subs(const GraphInstrument& instr);
+
+	// Forbid copy and affectation, instruments point to each other
+	BankGraph(BankGraph&);
+	BankGraph& operator=(BankGraph&);
+
+public:
+	BankGraph(const DataView& rom) : rom(rom)
+	{}
+
+	// Read the ninstr instruments of a bank, unless it's already read
+	// The bank must be within the ROM
+	const GraphBank& add_bank(uint32_t address, unsigned int ninstr);
+
+	// Bank read by add_bank, nullptr if there is none at address
+	const GraphBank *find_bank(uint32_t address) const
+	{
+		std::map<uint32_t, GraphBank>::const_iterator it = banks.find(address);
+		return it != banks.end() ? &it->second : nullptr;
+	}
+};
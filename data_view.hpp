@@ -0,0 +1,78 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Read-only view of a file loaded in memory (the GBA ROM or a data file).
+ * Accesses are bound-checked and throw -1 when they're out of the data, which is
+ * how the instrument and sample builders reject invalid data.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class DataView
+{
+	const uint8_t *data;
+	size_t data_size;
+
+public:
+	DataView() : data(nullptr), data_size(0)
+	{}
+
+	DataView(const std::vector<uint8_t>& v) : data(v.data()), data_size(v.size())
+	{}
+
+	DataView(const uint8_t *data, size_t size) : data(data), data_size(size)
+	{}
+
+	// True if the view contains data (i.e. the file was found)
+	explicit operator bool() const
+	{
+		return data != nullptr;
+	}
+
+	size_t size() const
+	{
+		return data_size;
+	}
+
+	// Pointer to len bytes at pos, throws -1 if they aren't all in the view
+	const uint8_t *at(size_t pos, size_t len = 1) const
+	{
+		if (!data || pos > data_size || len > data_size - pos) throw -1;
+		return data + pos;
+	}
+
+	uint8_t u8(size_t pos) const
+	{
+		return *at(pos);
+	}
+
+	uint32_t u32(size_t pos) const
+	{
+		const uint8_t *p = at(pos, 4);
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+};
+
+// Load a whole file in memory, returns false if it can't be read
+static inline bool load_file(const std::string& filename, std::vector<uint8_t>& data)
+{
+	FILE *f = fopen(filename.c_str(), "rb");
+	if (!f) return false;
+
+	bool ok = !fseek(f, 0L, SEEK_END);
+	long size = ftell(f);
+	ok = ok && size >= 0 && !fseek(f, 0L, SEEK_SET);
+	if (ok)
+	{
+		data.resize(size);
+		ok = fread(data.data(), 1, size, f) == (size_t)size;
+	}
+	fclose(f);
+	return ok;
+}
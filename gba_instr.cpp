@@ -7,28 +7,92 @@
  * GBA instruments and converts them to SF2 instruments
  */
 #include "gba_instr.hpp"
+#include <algorithm>
 #include <cmath>
-#include <cstdio>
 #include "hex_string.hpp"
 #include <vector>
-extern FILE *inGBA;					// Related .gba file
 
-bool operator <(const inst_data&i, const inst_data& j)
+int *GBAInstr::find_instrument(const inst_data& inst, int key_lo, int key_hi)
 {
-	if (j.word2 != i.word2) return i.word2 < j.word2;
-	else if (j.word1 != i.word1) return i.word1 < j.word1;
-	else return i.word0 < j.word0;
+	inst_key key = {inst, uint8_t(key_lo), uint8_t(key_hi)};
+	return inst_map.find(key);
 }
 
-uint32_t GBAInstr::get_GBA_pointer()
+int GBAInstr::add_instrument(const inst_data& inst, int key_lo, int key_hi)
 {
-	uint32_t p;
-	fread(&p, 4, 1, inGBA);
-	return p & 0x3FFFFFF;
+	inst_key key = {inst, uint8_t(key_lo), uint8_t(key_hi)};
+	inst_map.insert(key, cur_inst_index);
+	return cur_inst_index ++;
+}
+
+// SF2 generator amount of a time in seconds, in timecents
+// Times under 1 second are negative, converted through int16_t as a double to uint16_t conversion
+// of a negative value is undefined
+static uint16_t timecents(double seconds)
+{
+	return uint16_t(int16_t(1200 * log2(seconds)));
+}
+
+// SF2 envelope generators of every ADSR component value, computed once
+// Times of component value 0 are zero or infinite, they're 0 timecents (1 second) instead,
+// as the envelopes always had; only attack 0 and decay 0 of sampled instruments are used
+struct adsr_tables
+{
+	uint16_t attack[256], decay[256], sustain[256], release[256];
+	uint16_t psg_attack[16], psg_decay[16], psg_sustain[16], psg_release[16];
+
+	adsr_tables()
+	{
+		attack[0] = decay[0] = release[0] = 0;
+		sustain[0] = 1000;		// Special case where attenuation is infinite -> use max value
+		for (int i = 1; i < 256; i++)
+		{
+			// Compute attack time - the sound engine is called 60 times per second
+			// and adds "attack" to envelope every time the engine is called
+			double att_time = (256/60.0) / i;
+			attack[i] = timecents(att_time);
+
+			// Compute attenuation in cB
+			sustain[i] = uint16_t(100 * log(256.0/i));
+
+			double dec_time = (log(256.0) /(log(256)-log(i)))/60.0;
+			dec_time *= 10/log(256);
+			decay[i] = timecents(dec_time);
+
+			double rel_time = (log(256.0)/(log(256)-log(i)))/60.0;
+			release[i] = timecents(rel_time);
+		}
+
+		psg_attack[0] = psg_release[0] = 0;
+		psg_sustain[0] = 1000;
+		psg_decay[0] = 0;
+		for (int i = 1; i < 16; i++)
+		{
+			double att_time = i/5.0;
+			psg_attack[i] = timecents(att_time);
+
+			psg_sustain[i] = uint16_t(100 * log(15.0/i));
+
+			double dec_time = i/5.0;
+			psg_decay[i] = timecents(dec_time+1);
+
+			double rel_time = i/5.0;
+			psg_release[i] = timecents(rel_time);
+		}
+	}
+};
+
+static const adsr_tables& get_adsr_tables()
+{
+	// Built the first time it's needed, thread safe
+	static const adsr_tables tables;
+	return tables;
 }
 
 void GBAInstr::generate_adsr_generators(const uint32_t adsr)
 {
+	const adsr_tables& t = get_adsr_tables();
+
 	// Get separate components
 	int attack = adsr & 0xFF;
 	int decay = (adsr>>8) & 0xFF;
@@ -37,40 +101,22 @@ void GBAInstr::generate_adsr_generators(const uint32_t adsr)
 
 	// Add generators for ADSR envelope if required
 	if (attack != 0xFF)
-	{
-		// Compute attack time - the sound engine is called 60 times per second
-		// and adds "attack" to envelope every time the engine is called
-		double att_time = (256/60.0) / attack;
-		double att = 1200 * log2(att_time);
-		sf2->add_new_inst_generator(SFGenerator::attackVolEnv, uint16_t(att));
-	}
+		sf2->add_new_inst_generator(SFGenerator::attackVolEnv, t.attack[attack]);
 
 	if (sustain != 0xFF)
 	{
-		double sus;
-		// Compute attenuation in cB if sustain is non-zero
-		if (sustain != 0) sus = 100 * log(256.0/sustain);
-		// Special case where attenuation is infinite -> use max value
-		else sus = 1000;
-
-		sf2->add_new_inst_generator(SFGenerator::sustainVolEnv, uint16_t(sus));
-
-		double dec_time = (log(256.0) /(log(256)-log(decay)))/60.0;
-		dec_time *= 10/log(256);
-		double dec = 1200 * log2(dec_time);
-		sf2->add_new_inst_generator(SFGenerator::decayVolEnv, uint16_t(dec));
+		sf2->add_new_inst_generator(SFGenerator::sustainVolEnv, t.sustain[sustain]);
+		sf2->add_new_inst_generator(SFGenerator::decayVolEnv, t.decay[decay]);
 	}
 
 	if (release != 0x00)
-	{
-		double rel_time = (log(256.0)/(log(256)-log(release)))/60.0;
-		double rel = 1200 * log2(rel_time);
-		sf2->add_new_inst_generator(SFGenerator::releaseVolEnv, uint16_t(rel));
-	}
+		sf2->add_new_inst_generator(SFGenerator::releaseVolEnv, t.release[release]);
 }
 
 void GBAInstr::generate_psg_adsr_generators(const uint32_t adsr)
 {
+	const adsr_tables& t = get_adsr_tables();
+
 	// Get separate components
 	int attack = adsr & 0xFF;
 	int decay = (adsr>>8) & 0xFF;
@@ -82,59 +128,94 @@ void GBAInstr::generate_psg_adsr_generators(const uint32_t adsr)
 
 	// Add generators for ADSR envelope if required
 	if (attack != 0)
-	{
-		// Compute attack time - the sound engine is called 60 times per second
-		// and adds "attack" to envelope every time the engine is called
-		double att_time = attack/5.0;
-		double att = 1200 * log2(att_time);
-		sf2->add_new_inst_generator(SFGenerator::attackVolEnv, uint16_t(att));
-	}
+		sf2->add_new_inst_generator(SFGenerator::attackVolEnv, t.psg_attack[attack]);
 
 	if (sustain != 15)
 	{
-		double sus;
-		// Compute attenuation in cB if sustain is non-zero
-		if (sustain != 0) sus = 100 * log(15.0/sustain);
-		// Special case where attenuation is infinite -> use max value
-		else sus = 1000;
+		sf2->add_new_inst_generator(SFGenerator::sustainVolEnv, t.psg_sustain[sustain]);
+		sf2->add_new_inst_generator(SFGenerator::decayVolEnv, t.psg_decay[decay]);
+	}
 
-		sf2->add_new_inst_generator(SFGenerator::sustainVolEnv, uint16_t(sus));
+	if (release != 0)
+		sf2->add_new_inst_generator(SFGenerator::releaseVolEnv, t.psg_release[release]);
+}
 
-		double dec_time = decay/5.0;
-		double dec = 1200 * log2(dec_time+1);
-		sf2->add_new_inst_generator(SFGenerator::decayVolEnv, uint16_t(dec));
+void GBAInstr::add_split_zones(const std::vector<split_zone>& zones)
+{
+	std::vector<split_zone> merged;
+	for (unsigned int i = 0; i < zones.size(); i++)
+	{
+		const split_zone& z = zones[i];
+		if (!merged.empty())
+		{
+			split_zone& m = merged.back();
+			int m_pitch, z_pitch;
+			if (m.key_hi + 1 == z.key_lo && m.sample_index == z.sample_index && m.adsr == z.adsr
+			&& m.psg == z.psg && m.loop_flag == z.loop_flag && m.panning == z.panning)
+			{
+				// Same pitch for every key
+				if (m.root_key == z.root_key && m.no_scale == z.no_scale && m.coarse_tune == z.coarse_tune)
+				{
+					m.key_hi = z.key_hi;
+					continue;
+				}
+				// Same fixed pitch, which doesn't depend on the key any more
+				if (m.fixed_pitch(m_pitch) && z.fixed_pitch(z_pitch) && m_pitch == z_pitch)
+				{
+					if (!m.no_scale) m.root_key = -1;
+					m.no_scale = true;
+					m.coarse_tune = m_pitch;
+					m.key_hi = z.key_hi;
+					continue;
+				}
+			}
+		}
+		merged.push_back(z);
 	}
 
-	if (release != 0)
+	for (unsigned int i = 0; i < merged.size(); i++)
 	{
-		double rel_time = release/5.0;
-		double rel = 1200 * log2(rel_time);
-		sf2->add_new_inst_generator(SFGenerator::releaseVolEnv, uint16_t(rel));
+		const split_zone& z = merged[i];
+		sf2->add_new_inst_bag();
+		if (z.psg)
+			generate_psg_adsr_generators(z.adsr);
+		else
+			generate_adsr_generators(z.adsr);
+		// Add generator to prevent scaling if required
+		if (z.no_scale)
+			sf2->add_new_inst_generator(SFGenerator::scaleTuning, 0);
+		if (z.coarse_tune)
+			sf2->add_new_inst_generator(SFGenerator::coarseTune, z.coarse_tune);
+		if (z.root_key >= 0)
+			sf2->add_new_inst_generator(SFGenerator::overridingRootKey, z.root_key);
+		sf2->add_new_inst_generator(SFGenerator::keyRange, z.key_lo, z.key_hi);
+		if (z.panning != 0)
+			sf2->add_new_inst_generator(SFGenerator::pan, int((z.panning-192) * (500/128.0)));
+		sf2->add_new_inst_generator(SFGenerator::sampleModes, z.loop_flag ? 1 : 0);
+		sf2->add_new_inst_generator(SFGenerator::sampleID, z.sample_index);
 	}
 }
 
 // Build a SF2 instrument form a GBA sampled instrument
-int GBAInstr::build_sampled_instrument(const inst_data inst)
+int GBAInstr::build_sampled_instrument(const GraphInstrument& instr)
 {
+	const inst_data& inst = instr.inst;
+
 	// Do nothing if this instrument already exists !
-	inst_it it = inst_map.find(inst);
-	if (it != inst_map.end()) return (*it).second;
+	int *found = find_instrument(inst);
+	if (found) return *found;
 
 	// The flag is set if no scaling should be done if the instrument type is 8
 	bool no_scale = (inst.word0&0xff) == 0x08;
 
-	// Get sample pointer
-	uint32_t sample_pointer = inst.word1 & 0x3ffffff;
-
-	// Determine if loop is enabled (it's dumb but we have to seek just for this)
-	if (fseek(inGBA, sample_pointer|3, SEEK_SET)) throw -1;
-	bool loop_flag = fgetc(inGBA) == 0x40;
+	// Determine if loop is enabled
+	bool loop_flag = instr.sample.loop_flag();
 
 	// Build pointed sample
-	int sample_index = samples.build_sample(sample_pointer);
+	int sample_index = samples.build_sample(instr.sample);
 
 	// Instrument's name
-	std::string name = "sample @0x" + hex(sample_pointer);
+	std::string name = "sample @0x" + hex(instr.sample.pointer);
 
 	// Create instrument bag
 	sf2->add_new_instrument(name.c_str());
@@ -149,16 +230,18 @@ int GBAInstr::build_sampled_instrument(const inst_data inst)
 	sf2->add_new_inst_generator(SFGenerator::sampleID, sample_index);
 
 	// Add instrument to list
-	inst_map[inst] = cur_inst_index;
-	return cur_inst_index ++;
+	return add_instrument(inst);
 }
 
 // Create new SF2 from every key split GBA instrument
-int GBAInstr::build_every_keysplit_instrument(const inst_data inst)
+int GBAInstr::build_every_keysplit_instrument(const GraphInstrument& instr, int key_lo, int key_hi)
 {
+	const inst_data& inst = instr.inst;
+	if (!instr.subs) throw -1;
+
 	// Do nothing if this instrument already exists !
-	inst_it it = inst_map.find(inst);
-	if (it != inst_map.end()) return (*it).second;
+	int *found = find_instrument(inst, key_lo, key_hi);
+	if (found) return *found;
 
 	// I'm sorry for doing a dumb copy/pase of the routine right above
 	// But there was too much differences to handles to practically handle it with flags
@@ -166,65 +249,53 @@ int GBAInstr::build_every_keysplit_instrument(const inst_data inst)
 	uint32_t baseaddress = inst.word1 & 0x3ffffff;
 	std::string name = "EveryKeySplit @0x" + hex(baseaddress);
 	sf2->add_new_instrument(name.c_str());
+	std::vector<split_zone> zones;
 
 	// Loop through all keys
-	for (int key = 0; key < 128; key ++)
+	for (int key = key_lo; key <= key_hi; key ++)
 	{
 		try
 		{
-			// Seek at the key's instrument
-			if (fseek(inGBA, baseaddress + 12*key, SEEK_SET)) throw -1;
-
-			// Read instrument data
-			int instrType = fgetc(inGBA);		// Instrument type
-			int keynum = fgetc(inGBA);			// Key (every key split instrument only)
-		/*  int unused_byte =*/ fgetc(inGBA);		// Unknown/unused byte
-			int panning = fgetc(inGBA);			// Panning (every key split instrument only)
-
-			// The flag is set if no scaling should be done on the sample
-			bool no_scale = false;
-
-			uint32_t main_word, adsr;
-			fread(&main_word, 4, 1, inGBA);
-
+			// The key's instrument data
+			const GraphInstrument& key_inst = (*instr.subs)[key];
+			if (!key_inst.valid) continue;
+			int instrType = key_inst.inst.word0 & 0xff;			// Instrument type
+			int keynum = (key_inst.inst.word0 >> 8) & 0xff;		// Key (every key split instrument only)
+			int panning = key_inst.inst.word0 >> 24;			// Panning (every key split instrument only), byte 2 is unused
+
+			uint32_t main_word = key_inst.inst.word1;
+
+			// Zone for this key, key range is only a single key (obviously)
+			split_zone zone;
+			zone.key_lo = zone.key_hi = key;
 			// Get ADSR envelope
-			fread(&adsr, 4, 1, inGBA);
-
-			int sample_index;
-			bool loop_flag = true;
+			zone.adsr = key_inst.inst.word2;
+			zone.psg = false;
+			// The flag is set if no scaling should be done on the sample
+			zone.no_scale = false;
+			zone.loop_flag = true;
+			zone.coarse_tune = 0;
+			zone.panning = panning;
 
 			switch (instrType & 0x0f)
 			{
 				case 8:
-					no_scale = true;
+					zone.no_scale = true;
 				case 0:
 				{
 					// Determine if loop is enabled and read sample's pitch
-					uint32_t sample_pointer = main_word & 0x3ffffff;
-					if (fseek(inGBA, sample_pointer|3, SEEK_SET)) throw -1;
-					loop_flag = fgetc(inGBA) == 0x40;
-
-					uint32_t pitch;
-					fread(&pitch, 4, 1, inGBA);
+					zone.loop_flag = key_inst.sample.loop_flag();
+					uint32_t pitch = key_inst.sample.pitch;
 
 					// Build pointed sample
-					sample_index = samples.build_sample(sample_pointer);
-
-					// Add a bag for this key
-					sf2->add_new_inst_bag();
-					generate_adsr_generators(adsr);
-					// Add generator to prevent scaling if required
-					if (no_scale)
-						sf2->add_new_inst_generator(SFGenerator::scaleTuning, 0);
+					zone.sample_index = samples.build_sample(key_inst.sample);
 
 					// Compute base note and fine tune from pitch
 					double delta_note = 12.0 * log2(sf2->default_sample_rate * 1024.0 / pitch);
 					int rootkey = 60 + int(round(delta_note));
 
 					// Override root key with the value we need
-					sf2->add_new_inst_generator(SFGenerator::overridingRootKey, rootkey - keynum + key);
-					// Key range is only a single key (obviously)
-					sf2->add_new_inst_generator(SFGenerator::keyRange, key, key);
+					zone.root_key = rootkey - keynum + key;
 				}	break;
 
 				case 4:
@@ -239,40 +310,39 @@ int GBAInstr::build_every_keysplit_instrument(const inst_data inst)
 					else
 						throw -1;
 
+					// Reject invalid GameBoy ADSR envelopes now, every component is 0-15
+					if (zone.adsr & 0xf0f0f0f0) throw -1;
+
 					// Build corresponding sample
-					sample_index = samples.build_noise_sample(metal_flag, keynum);
-					sf2->add_new_inst_bag();
-					generate_psg_adsr_generators(adsr);
-					sf2->add_new_inst_generator(SFGenerator::overridingRootKey, key);
-					sf2->add_new_inst_generator(SFGenerator::keyRange, key, key);
+					zone.sample_index = samples.build_noise_sample(metal_flag, keynum);
+					zone.psg = true;
+					zone.root_key = key;
 				}	break;
 
 				// Ignore other kind of instruments
 				default : throw -1;
 			}
-
-			if (panning != 0)
-				sf2->add_new_inst_generator(SFGenerator::pan, int((panning-192) * (500/128.0)));
-			// Same as a normal sample
-			sf2->add_new_inst_generator(SFGenerator::sampleModes, loop_flag ? 1 : 0);
-			sf2->add_new_inst_generator(SFGenerator::sampleID, sample_index);
+			zones.push_back(zone);
 		}
 		catch (...) {}	// Continue to next key when there is a major problem
 	}
+	add_split_zones(zones);
+
 	// Add instrument to list
-	inst_map[inst] = cur_inst_index;
-	return cur_inst_index ++;
+	return add_instrument(inst, key_lo, key_hi);
 }
 
 // Build a SF2 instrument from a GBA key split instrument
-int GBAInstr::build_keysplit_instrument(const inst_data inst)
+int GBAInstr::build_keysplit_instrument(const GraphInstrument& instr, int key_lo, int key_hi)
 {
+	const inst_data& inst = instr.inst;
+	if (!instr.data || !instr.subs) throw -1;
+
 	// Do nothing if this instrument already exists !
-	inst_it it = inst_map.find(inst);
-	if (it != inst_map.end()) return (*it).second;
+	int *found = find_instrument(inst, key_lo, key_hi);
+	if (found) return *found;
 
 	uint32_t base_pointer = inst.word1 & 0x3ffffff;
-	uint32_t key_table = inst.word2 & 0x3ffffff;
 
 	// Decode key-table in usable data
 	std::vector<int8_t> split_list, index_list;
@@ -280,7 +350,7 @@ int GBAInstr::build_keysplit_instrument(const inst_data inst)
 	int8_t key = 0;
 	int prev_index = -1;
 	int current_index;
-	if (fseek(inGBA, key_table, SEEK_SET)) throw -1;
+	const uint8_t *table = instr.data;
 
 	// Add instrument to list
 	std::string name = "0x" + hex(base_pointer) + " key split";
@@ -288,7 +358,7 @@ int GBAInstr::build_keysplit_instrument(const inst_data inst)
 
 	do
 	{
-		int index = fgetc(inGBA);
+		int index = table[key];
 
 		// Detect where there is changes in the index table
 		current_index = index;
@@ -303,78 +373,75 @@ int GBAInstr::build_keysplit_instrument(const inst_data inst)
 
 	// Final entry for the last split
 	split_list.push_back(0x80);
+	std::vector<split_zone> zones;
 
 	for (unsigned int i=0; i<index_list.size(); i++)
 	{
+		// Skip splits which aren't used by any of the converted keys
+		if (uint8_t(split_list[i+1]) <= key_lo || split_list[i] > key_hi) continue;
+
 		try
 		{
-			// Seek to pointed instrument
-			if (fseek(inGBA, base_pointer + 12*index_list[i], SEEK_SET)) throw -1;
+			// Pointed instrument, entries with MSB set are invalid
+			if (index_list[i] < 0) continue;
+			const GraphInstrument& split_inst = (*instr.subs)[index_list[i]];
+			if (!split_inst.valid) continue;
 
 			// Once again I'm sorry for the dumb copy/pase
 			// but doing it all with flags would have been quite complex
 
-			int inst_type = fgetc(inGBA);		// Instrument type
-		 /* int keynum = */ fgetc(inGBA);		// Key (every key split instrument only)
-		 /* int unused_byte = */ fgetc(inGBA);	// Unknown/unused byte
-		 /* int panning = */ fgetc(inGBA);		// Panning (every key split instrument only)
+			int inst_type = split_inst.inst.word0 & 0xff;		// Instrument type
+			// Key, unused byte and panning are only used by every key split instruments
 
-			// The flag is set if no scaling should be done on the sample
-			bool no_scale = inst_type==8;
+			// Particularity here : the zone covers the split's key range
+			split_zone zone;
+			zone.key_lo = split_list[i];
+			zone.key_hi = uint8_t(split_list[i+1]) - 1;
 
-			// Get sample pointer
-			uint32_t sample_pointer;
-			fread(&sample_pointer, 1, 4, inGBA);
-			sample_pointer &= 0x3ffffff;
+			// The flag is set if no scaling should be done on the sample
+			zone.no_scale = inst_type==8;
 
 			// Get ADSR envelope
-			uint32_t adsr;
-			fread(&adsr, 4, 1, inGBA);
+			zone.adsr = split_inst.inst.word2;
+			zone.psg = false;
 
 			// For now GameBoy instruments aren't supported
 			// (I wonder if any game ever used this)
 			if ((inst_type & 0x07) != 0) continue;
 
-			// Determine if loop is enabled (it's dumb but we have to seek just for this)
-			if (fseek(inGBA, sample_pointer|3, SEEK_SET)) throw -1;
-			bool loop_flag = fgetc(inGBA) == 0x40;
+			// Determine if loop is enabled
+			zone.loop_flag = split_inst.sample.loop_flag();
 
 			// Build pointed sample
-			int sample_index = samples.build_sample(sample_pointer);
-
-			// Create instrument bag
-			sf2->add_new_inst_bag();
-
-			// Add generator to prevent scaling if required
-			if (no_scale)
-				sf2->add_new_inst_generator(SFGenerator::scaleTuning, 0);
-
-			generate_adsr_generators(adsr);
-			// Particularity here : An additional bag to select the key range
-			sf2->add_new_inst_generator(SFGenerator::keyRange, split_list[i], split_list[i+1]-1);
-			sf2->add_new_inst_generator(SFGenerator::sampleModes, loop_flag ? 1 : 0);
-			sf2->add_new_inst_generator(SFGenerator::sampleID, sample_index);
+			zone.sample_index = samples.build_sample(split_inst.sample);
+			zone.coarse_tune = 0;
+			zone.root_key = -1;
+			zone.panning = 0;
+			zones.push_back(zone);
 		}
 		catch (...) {}		// Silently continue to next key if anything bad happens
 	}
-	inst_map[inst] = cur_inst_index;
-	return cur_inst_index ++;
+	add_split_zones(zones);
+	return add_instrument(inst, key_lo, key_hi);
 }
 
 // Build gameboy channel 3 instrument
-int GBAInstr::build_GB3_instrument(const inst_data inst)
+int GBAInstr::build_GB3_instrument(const GraphInstrument& instr)
 {
+	const inst_data& inst = instr.inst;
+
 	// Do nothing if this instrument already exists !
-	inst_it it = inst_map.find(inst);
-	if (it != inst_map.end()) return (*it).second;
+	int *found = find_instrument(inst);
+	if (found) return *found;
 
 	// Get sample pointer
 	uint32_t sample_pointer = inst.word1 & 0x3ffffff;
 
-	// Try to seek to see if the pointer is valid, if it's not then abort
-	if (fseek(inGBA, sample_pointer, SEEK_SET)) throw -1;
+	// Check if the pointer is valid, if it's not then abort
+	if (!instr.data) throw -1;
 
-	int sample = samples.build_GB3_samples(sample_pointer);
+	int sample[4];
+	samples.build_GB3_samples(sample_pointer, sample);
 
 	std::string name = "GB3 @0x" + hex(sample_pointer);
 	sf2->add_new_instrument(name.c_str());
@@ -386,38 +453,37 @@ int GBAInstr::build_GB3_instrument(const inst_data inst)
 	sf2->add_new_inst_bag();
 	sf2->add_new_inst_generator(SFGenerator::keyRange, 0, 52);
 	sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
-	sf2->add_new_inst_generator(SFGenerator::sampleID, sample-3);
+	sf2->add_new_inst_generator(SFGenerator::sampleID, sample[0]);
 	sf2->add_new_inst_bag();
 	sf2->add_new_inst_generator(SFGenerator::keyRange, 53, 64);
 	sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
-	sf2->add_new_inst_generator(SFGenerator::sampleID, sample-2);
+	sf2->add_new_inst_generator(SFGenerator::sampleID, sample[1]);
 	sf2->add_new_inst_bag();
 	sf2->add_new_inst_generator(SFGenerator::keyRange, 65, 76);
 	sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
-	sf2->add_new_inst_generator(SFGenerator::sampleID, sample-1);
+	sf2->add_new_inst_generator(SFGenerator::sampleID, sample[2]);
 	sf2->add_new_inst_bag();
 	sf2->add_new_inst_generator(SFGenerator::keyRange, 77, 127);
 	sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
-	sf2->add_new_inst_generator(SFGenerator::sampleID, sample);
+	sf2->add_new_inst_generator(SFGenerator::sampleID, sample[3]);
 
-	inst_map[inst] = cur_inst_index;
-	return cur_inst_index ++;
+	return add_instrument(inst);
 }
 
 // Build GameBoy pulse wave instrument
-int GBAInstr::build_pulse_instrument(const inst_data inst)
+int GBAInstr::build_pulse_instrument(const GraphInstrument& instr)
 {
+	const inst_data& inst = instr.inst;
+
 	// Do nothing if this instrument already exists !
-	inst_it it = inst_map.find(inst);
-	if (it != inst_map.end()) return (*it).second;
+	int *found = find_instrument(inst);
+	if (found) return *found;
 
 	unsigned int duty_cycle = inst.word1;
-	// The difference between 75% and 25% duty cycles is inaudible therefore
-	// I simply replace 75% duty cycles by 25%
-	if (duty_cycle == 3) duty_cycle = 1;
 	if (duty_cycle > 3) throw -1;
 
-	int sample = samples.build_pulse_samples(duty_cycle);
+	int sample[PULSE_RANGES];
+	samples.build_pulse_samples(duty_cycle, sample);
 	std::string name = "pulse " + std::to_string(duty_cycle);
 	sf2->add_new_instrument(name.c_str());
 
@@ -425,37 +491,26 @@ int GBAInstr::build_pulse_instrument(const inst_data inst)
 	sf2->add_new_inst_bag();
 	generate_psg_adsr_generators(inst.word2);
 
-	sf2->add_new_inst_bag();
-	sf2->add_new_inst_generator(SFGenerator::keyRange, 0, 45);
-	sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
-	sf2->add_new_inst_generator(SFGenerator::sampleID, sample-4);
-	sf2->add_new_inst_bag();
-	sf2->add_new_inst_generator(SFGenerator::keyRange, 46, 57);
-	sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
-	sf2->add_new_inst_generator(SFGenerator::sampleID, sample-3);
-	sf2->add_new_inst_bag();
-	sf2->add_new_inst_generator(SFGenerator::keyRange, 58, 69);
-	sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
-	sf2->add_new_inst_generator(SFGenerator::sampleID, sample-2);
-	sf2->add_new_inst_bag();
-	sf2->add_new_inst_generator(SFGenerator::keyRange, 70, 81);
-	sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
-	sf2->add_new_inst_generator(SFGenerator::sampleID, sample-1);
-	sf2->add_new_inst_bag();
-	sf2->add_new_inst_generator(SFGenerator::keyRange, 82, 127);
-	sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
-	sf2->add_new_inst_generator(SFGenerator::sampleID, sample);
+	// A sample per octave, around its root key
+	for (int i = 0; i < PULSE_RANGES; i++)
+	{
+		sf2->add_new_inst_bag();
+		sf2->add_new_inst_generator(SFGenerator::keyRange, i == 0 ? 0 : 30 + 12*i, i == PULSE_RANGES-1 ? 127 : 41 + 12*i);
+		sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
+		sf2->add_new_inst_generator(SFGenerator::sampleID, sample[i]);
+	}
 
-	inst_map[inst] = cur_inst_index;
-	return cur_inst_index ++;
+	return add_instrument(inst);
 }
 
 // Build GameBoy white noise instrument
-int GBAInstr::build_noise_instrument(const inst_data inst)
+int GBAInstr::build_noise_instrument(const GraphInstrument& instr, int key_lo, int key_hi)
 {
+	const inst_data& inst = instr.inst;
+
 	// Do nothing if this instrument already exists !
-	inst_it it = inst_map.find(inst);
-	if (it != inst_map.end()) return (*it).second;
+	int *found = find_instrument(inst, key_lo, key_hi);
+	if (found) return *found;
 
 	// 0 = normal, 1 = metallic, anything else = invalid
 	if (inst.word1 > 1) throw -1;
@@ -468,13 +523,16 @@ int GBAInstr::build_noise_instrument(const inst_data inst)
 	sf2->add_new_inst_bag();
 	generate_psg_adsr_generators(inst.word2);
 
-	sf2->add_new_inst_bag();
-	int sample42 = samples.build_noise_sample(metallic, 42);
-	sf2->add_new_inst_generator(SFGenerator::keyRange, 0, 42);
-	sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
-	sf2->add_new_inst_generator(SFGenerator::sampleID, sample42);
+	if (key_lo <= 42)
+	{
+		sf2->add_new_inst_bag();
+		int sample42 = samples.build_noise_sample(metallic, 42);
+		sf2->add_new_inst_generator(SFGenerator::keyRange, 0, 42);
+		sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
+		sf2->add_new_inst_generator(SFGenerator::sampleID, sample42);
+	}
 
-	for (int key = 43; key <=77; key++)
+	for (int key = std::max(43, key_lo); key <= std::min(77, key_hi); key++)
 	{
 		sf2->add_new_inst_bag();
 		int sample = samples.build_noise_sample(metallic, key);
@@ -483,13 +541,15 @@ int GBAInstr::build_noise_instrument(const inst_data inst)
 		sf2->add_new_inst_generator(SFGenerator::sampleID, sample);
 	}
 
-	sf2->add_new_inst_bag();
-	int sample78 = samples.build_noise_sample(metallic, 78);
-	sf2->add_new_inst_generator(SFGenerator::keyRange, 78, 127);
-	sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
-	sf2->add_new_inst_generator(SFGenerator::scaleTuning, 0);
-	sf2->add_new_inst_generator(SFGenerator::sampleID, sample78);
+	if (key_hi >= 78)
+	{
+		sf2->add_new_inst_bag();
+		int sample78 = samples.build_noise_sample(metallic, 78);
+		sf2->add_new_inst_generator(SFGenerator::keyRange, 78, 127);
+		sf2->add_new_inst_generator(SFGenerator::sampleModes, 1);
+		sf2->add_new_inst_generator(SFGenerator::scaleTuning, 0);
+		sf2->add_new_inst_generator(SFGenerator::sampleID, sample78);
+	}
 
-	inst_map[inst] = cur_inst_index;
-	return cur_inst_index ++;
+	return add_instrument(inst, key_lo, key_hi);
 }
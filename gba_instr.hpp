@@ -8,51 +8,101 @@
 #pragma once
 
 #include <cstdint>
-#include <map>
+#include <vector>
 #include "sf2.hpp"
 #include "gba_samples.hpp"
+#include "bank_graph.hpp"
+#include "hash_map.hpp"
 
-struct inst_data
+struct inst_data_hash
 {
-	uint32_t word0;
-	uint32_t word1;
-	uint32_t word2;
+	uint32_t operator ()(const inst_data& i) const
+	{
+		return hash_mix(i.word0 ^ hash_mix(i.word1 ^ hash_mix(i.word2)));
+	}
 };
 
-typedef std::map<inst_data, int>::iterator inst_it;
+// Instrument already converted, key split instruments are converted only from key_lo to key_hi
+struct inst_key
+{
+	inst_data inst;
+	uint8_t key_lo, key_hi;
+
+	bool operator ==(const inst_key& k) const
+	{
+		return inst == k.inst && key_lo == k.key_lo && key_hi == k.key_hi;
+	}
+};
+
+struct inst_key_hash
+{
+	uint32_t operator ()(const inst_key& k) const
+	{
+		return inst_data_hash()(k.inst) ^ (k.key_lo << 8 | k.key_hi);
+	}
+};
+
+// Zone of a key split instrument, adjacent keys with the same zone are merged in a single one
+struct split_zone
+{
+	int key_lo, key_hi;
+	int sample_index;
+	uint32_t adsr;
+	bool psg;			// ADSR envelope of a GameBoy channel
+	bool no_scale;		// The pitch doesn't depend on the key, it's coarse_tune
+	bool loop_flag;
+	int coarse_tune;
+	int root_key;		// Overriding root key, -1 if none
+	int panning;		// 0 if not panned
+
+	// Pitch of the sample, in semitones, if it's the same for all keys of the zone
+	bool fixed_pitch(int& pitch) const
+	{
+		if (no_scale) pitch = coarse_tune;
+		else if (key_lo == key_hi && root_key >= 0) pitch = key_lo - root_key;
+		else return false;
+		return true;
+	}
+};
 
 class GBAInstr
 {
 	int cur_inst_index;
-	std::map<inst_data, int> inst_map;	// Contains pointers to instruments within GBA file, their position is the # of instrument in the SF2
+	OpenHashMap<inst_key, int, inst_key_hash> inst_map;	// Instruments within GBA file which are already converted, and their # in the SF2
 	SF2 *sf2;										// Related .sf2 file
 	GBASamples samples;								// Related samples class
-
-	// Convert pointer from GBA memory map to ROM memory map
-	uint32_t get_GBA_pointer();
 	// Apply ADSR envelope on the instrument
 	void generate_adsr_generators(const uint32_t adsr);
 	void generate_psg_adsr_generators(const uint32_t adsr);
+	// Add the zones of a key split instrument, merging adjacent zones which are the same
+	void add_split_zones(const std::vector<split_zone>& zones);
+
+	// # of an instrument in the SF2 if it's already converted, nullptr otherwise
+	int *find_instrument(const inst_data& inst, int key_lo = 0, int key_hi = 127);
+	// Add the instrument which was just converted to the list, returns its #
+	int add_instrument(const inst_data& inst, int key_lo = 0, int key_hi = 127);
 
 public:
-	GBAInstr(SF2 *sf2) : cur_inst_index(0), sf2(sf2), samples(sf2)
+	GBAInstr(SF2 *sf2, const GBASoundData& data) : cur_inst_index(0), sf2(sf2), samples(sf2, data)
 	{}
 
+	// Instruments are read from the bank graph, see bank_graph.hpp
+
 	//Build a SF2 instrument form a GBA sampled instrument
-	int build_sampled_instrument(const inst_data inst);
+	int build_sampled_instrument(const GraphInstrument& instr);
 
-	//Create new SF2 from every key split GBA instrument
-	int build_every_keysplit_instrument(const inst_data inst);
+	//Create new SF2 from every key split GBA instrument, only keys key_lo to key_hi are converted
+	int build_every_keysplit_instrument(const GraphInstrument& instr, int key_lo = 0, int key_hi = 127);
 
-	//Build a SF2 instrument from a GBA key split instrument
-	int build_keysplit_instrument(const inst_data inst);
+	//Build a SF2 instrument from a GBA key split instrument, only splits used by keys key_lo to key_hi are converted
+	int build_keysplit_instrument(const GraphInstrument& instr, int key_lo = 0, int key_hi = 127);
 
 	//Build gameboy channel 3 instrument
-	int build_GB3_instrument(const inst_data inst);
+	int build_GB3_instrument(const GraphInstrument& instr);
 
 	//Build GameBoy pulse wave instrument
-	int build_pulse_instrument(const inst_data inst);
+	int build_pulse_instrument(const GraphInstrument& instr);
 
-	//Build GameBoy white noise instrument
-	int build_noise_instrument(const inst_data inst);
+	//Build GameBoy white noise instrument, only keys key_lo to key_hi are converted
+	int build_noise_instrument(const GraphInstrument& instr, int key_lo = 0, int key_hi = 127);
 };
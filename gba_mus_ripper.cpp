@@ -14,15 +14,14 @@
 #include <stdint.h>
 #include <string.h>
 #include <vector>
-#include <set>
+#include <algorithm>
 #include "hex_string.hpp"
+#include "known_games.hpp"
+#include "rom_index.hpp"
+#include "pointer_index.hpp"
+#include "sappy_detect.h"				// The detection function is called directly
 
 #ifndef WIN32
-namespace sappy_detector
-{
-    #include "sappy_detector.c"             // The main::function is called directly on Linux
-}
-
 #define GBA_MUS_RIPPER_NAME "gba_mus_ripper"
 #define SONG_RIPPER_NAME "song_ripper"
 #define SOUND_FRONT_RIPPER_NAME "sound_font_ripper"
@@ -46,6 +45,9 @@ static bool xg = false;
 static bool rc = false;
 static bool sb = false;
 static bool raw = false;
+static bool us = false;
+static bool trim = false;
+static bool ps = false;
 static uint32_t song_tbl_ptr = 0;
 
 static const int sample_rates[] = {-1, 5734, 7884, 10512, 13379, 15768, 18157, 21024, 26758, 31536, 36314, 40137, 42048};
@@ -62,16 +64,130 @@ static void print_instructions()
 		"-xg  : Output MIDI will be compliant to XG standard (instead of default GS standard).\n"
 		"-sb  : Separate banks. Every sound bank is riper to a different .sf2 file and placed into different sub-folders (instead of doing it in a single .sf2 file and a single folder).\n"
 		"-raw : Output MIDIs exactly as they're encoded in ROM, without linearise volume and velocities and without simulating vibratos.\n"
+		"-us  : Unused songs. Also search the whole ROM for songs which are not referenced by the song table (unused or beta songs) and rip them too.\n"
+		"-trim: Only put the instruments and keys played by the ripped songs in the soundfont(s).\n"
+		"-ps  : Per song soundfonts. Every song gets its own .sf2 file, next to its .mid file, with only the instruments and keys it plays (instead of soundfonts of whole sound banks).\n"
 		"[address]: Force address of the song table manually. This is required for manually dumping music data from ROMs where the location can't be detected automatically.\n"
 	);
 	exit(0);
 }
 
-static uint32_t get_GBA_pointer()
+static uint32_t read_u32(const uint8_t *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
+}
+
+// Load the whole input GBA file in memory
+static std::vector<uint8_t> read_rom()
+{
+	std::vector<uint8_t> rom(inGBA_size);
+	if (fseek(inGBA, 0L, SEEK_SET) || fread(rom.data(), 1, inGBA_size, inGBA) != inGBA_size)
+	{
+		fprintf(stderr, "Error: Can't read input GBA file in memory.\n");
+		exit(-1);
+	}
+	return rom;
+}
+
+// Test if a byte can be the very first command of a track
+static bool is_track_start_command(uint8_t cmd)
+{
+	// Repeated commands need a previous command, and a track shouldn't start by ending
+	if (cmd < 0x80 || cmd == 0xb1 || cmd == 0xb4 || cmd == 0xce) return false;
+	// Unassigned commands
+	if ((cmd >= 0xb5 && cmd <= 0xba) || cmd == 0xc6 || cmd == 0xc7 || (cmd >= 0xc9 && cmd <= 0xcc)) return false;
+	return true;
+}
+
+// Test if a song header could be located at the given (word aligned) offset
+//
+// A song header is made of the # of tracks, an unknown byte, the priority, the reverb,
+// a pointer to the sound bank and a pointer to each track. Tracks are always located
+// before their header, in increasing order.
+static bool is_song_header(const std::vector<uint8_t>& rom, uint32_t offset)
+{
+	unsigned int track_amnt = rom[offset];
+	if (track_amnt < 1 || track_amnt > 16) return false;
+	if (offset + 8 + 4 * track_amnt > rom.size()) return false;
+
+	// Reverb is either disabled or has its MSB set
+	uint8_t reverb = rom[offset + 3];
+	if (reverb != 0 && reverb < 0x80) return false;
+
+	uint32_t bank_ptr = read_u32(&rom[offset + 4]);
+	if (((bank_ptr >> 24) & 0xfe) != 0x08 || (bank_ptr & 3) || (bank_ptr & 0x1ffffff) + 12 > rom.size()) return false;
+
+	uint32_t prev_track = 0;
+	for (unsigned int i = 0; i < track_amnt; i++)
+	{
+		uint32_t track_ptr = read_u32(&rom[offset + 8 + 4 * i]);
+		if (((track_ptr >> 24) & 0xfe) != 0x08) return false;
+		track_ptr &= 0x1ffffff;
+		if (track_ptr >= offset || track_ptr <= prev_track) return false;
+		if (!is_track_start_command(rom[track_ptr])) return false;
+		prev_track = track_ptr;
+	}
+	return true;
+}
+
+// Test if an entry of the song table, between tbl_start and tbl_end, points to the given offset
+static bool in_song_table(const PointerIndex& pointers, uint32_t offset, uint32_t tbl_start, uint32_t tbl_end)
+{
+	std::pair<const PointerIndex::Ref *, const PointerIndex::Ref *> refs = pointers.find(offset);
+	for (const PointerIndex::Ref *r = refs.first; r != refs.second; ++r)
+	{
+		if (r->source >= tbl_start && r->source < tbl_end && (r->source - tbl_start) % 8 == 0)
+			return true;
+	}
+	return false;
+}
+
+// Search the whole ROM for song headers which are not referenced by the song table
+// A song header is followed by a pointer (to the sound bank), so only the words before a pointer are tested
+static std::vector<uint32_t> find_unused_songs(const std::vector<uint8_t>& rom, const PointerIndex& pointers,
+                                               uint32_t tbl_start, uint32_t tbl_end)
+{
+	std::vector<uint32_t> unused_songs;
+	const std::vector<PointerIndex::Ref>& refs = pointers.all();
+	for (size_t i = 0; i < refs.size(); i++)
+	{
+		uint32_t offset = refs[i].source - 4;
+		if (refs[i].source >= 4 && is_song_header(rom, offset) && !in_song_table(pointers, offset, tbl_start, tbl_end))
+			unused_songs.push_back(offset);
+	}
+	// Pointers are sorted by what they point to, songs are ripped in the order they're in the ROM
+	std::sort(unused_songs.begin(), unused_songs.end());
+	return unused_songs;
+}
+
+// Find the sound bank of every song and the list of sound banks, in increasing order
+// A song's bank is pointed to by the word after the first one of its header. Going through the pointers
+// of the ROM gives the banks in order, each with the songs using it.
+static void collect_sound_banks(const PointerIndex& pointers, const std::vector<uint32_t>& song_list, uint32_t song_tbl_end_ptr, RomIndex& index)
 {
-	uint32_t p;
-	fread(&p, 4, 1, inGBA);
-	return p - 0x8000000;
+	// Songs by the offset of their bank pointer
+	// Ignore unused song, which points to the end of the song table (for some reason)
+	std::vector<std::pair<uint32_t, uint32_t> > bank_ptrs;
+	for (uint32_t i = 0; i < song_list.size(); i++)
+	{
+		if (song_list[i] != song_tbl_end_ptr)
+			bank_ptrs.push_back(std::make_pair(song_list[i] + 4, i));
+	}
+	std::sort(bank_ptrs.begin(), bank_ptrs.end());
+
+	index.banks.clear();
+	index.song_banks.assign(song_list.size(), ROM_INDEX_NO_BANK);
+	const std::vector<PointerIndex::Ref>& refs = pointers.all();
+	for (size_t i = 0; i < refs.size(); i++)
+	{
+		std::vector<std::pair<uint32_t, uint32_t> >::iterator song = std::lower_bound(bank_ptrs.begin(), bank_ptrs.end(), std::make_pair(refs[i].source, 0u));
+		for (; song != bank_ptrs.end() && song->first == refs[i].source; ++song)
+		{
+			if (index.banks.empty() || index.banks.back() != refs[i].target)
+				index.banks.push_back(refs[i].target);
+			index.song_banks[song->second] = index.banks.size() - 1;
+		}
+	}
 }
 
 static void mkdir(std::string name)
@@ -83,6 +199,14 @@ static void mkdir(std::string name)
     #endif
 }
 
+// Call sound_font_ripper, returns false (with an error message) if it didn't rip every sound bank or song
+static bool call_sound_font_ripper(const std::string& cmd)
+{
+	if (!system(cmd.c_str())) return true;
+	fputs("Error: sound_font_ripper couldn't rip every sound bank.\n", stderr);
+	return false;
+}
+
 //  Convert number to string with always 4 digits (even if leading zeroes)
 //  Mother 3 is a game which needs the 4 digits.
 static std::string dec4(unsigned int n)
@@ -116,6 +240,12 @@ static void parse_args(const int argc, char *const args[])
 				sb = true;
 			else if (!strcmp(args[i], "-raw"))
 				raw = true;
+			else if (!strcmp(args[i], "-us"))
+				us = true;
+			else if (!strcmp(args[i], "-trim"))
+				trim = true;
+			else if (!strcmp(args[i], "-ps"))
+				ps = true;
             else if (!strcmp(args[i], "-o") && argc >= i + 1)
             {
                 outPath = args[i + 1];
@@ -170,68 +300,61 @@ static void parse_args(const int argc, char *const args[])
 	}
 }
 
-int main(int argc, char *const argv[])
+// Look the ROM up in the known games, game is then its entry if it's found,
+// or only the identification of the ROM if it isn't
+static bool find_game(const std::vector<uint8_t>& rom, const std::string& prg_prefix, KnownGame& game)
 {
-	// Parse arguments (without program name)
-	parse_args(argc - 1, argv + 1);
-
-	if (outPath.size() == 0)
-	{
-		outPath = ".";
-	}
-
-	// Compute program prefix (should be "", "./", "../" or whathever)
-	std::string prg_name = argv[0];
-	std::string prg_prefix = prg_name.substr(0, prg_name.rfind(GBA_MUS_RIPPER_NAME));
+	uint8_t header[GBA_HEADER_SIZE] = {0};
+	memcpy(header, rom.data(), std::min(rom.size(), sizeof(header)));
+	identify_game(header, game);
+
+	std::vector<KnownGame> games;
+	load_known_games(prg_prefix + "known_games.txt", games);
+	const KnownGame *known = find_known_game(header, games);
+	if (known) game = *known;
+	return known;
+}
 
+// Find the song table, songs and sound banks of the ROM
+// The known game is used unless the user has provided the address of the song table manually
+static void analyze_rom(const std::vector<uint8_t>& rom, KnownGame game, bool known, RomIndex& index)
+{
 	int sample_rate = 0, main_volume = 0;		// Use default values when those are '0'
 
-	// If the user hasn't provided an address manually, we'll try to automatically detect it
+	// If the user hasn't provided an address manually, we'll use the known game,
+	// and try to automatically detect it if it isn't known
+	bool scanned = false, skip_zeros = true, params_m32 = false;
 	if (!song_tbl_ptr)
 	{
-		// Auto-detect address of sappy engine
-#ifdef WIN32
-		// On windows, just use the 32-bit return code of the sappy_detector executable
-		std::string sappy_detector_cmd = prg_prefix + "sappy_detector \"" + inGBA_path + "\"";
-        printf("DEBUG: Going to call system(%s)\n", sappy_detector_cmd.c_str());
-		int sound_engine_adr = std::system(sappy_detector_cmd.c_str());
-#else
-		// On linux the function is duplicated in this executable
-		const char *sappy_detector_argv1 = inGBA_path.c_str();
-		int sound_engine_adr = sappy_detector::main(2, &sappy_detector_argv1 - 1);
-#endif
-
-		// Exit if no sappy engine was found
-		if (!sound_engine_adr) exit(0);
-
-		if (fseek(inGBA, sound_engine_adr, SEEK_SET))
+		if (known)
 		{
-			fprintf(stderr, "Error: Invalid offset within input GBA file: 0x%x\n", sound_engine_adr);
-			exit(0);
+			printf("Known game %.4s, song table at 0x%x.\n", game.code, game.song_table);
+			if (game.quirks & QUIRK_PARAMS_M32)
+				puts("Its engine parameters are 32 bytes before the main function.");
+			sample_rate = game.sample_rate;
+			main_volume = game.main_volume;
+			song_tbl_ptr = game.song_table;
+			skip_zeros = game.quirks & QUIRK_LEADING_ZEROS;
+		}
+		else
+		{
+			// Auto-detect address of sappy engine
+			sappy_engine_t engine;
+			bool found = sappy_detect(rom.data(), rom.size(), &engine);
+			print_engine(&engine);
+
+			// Exit if no sappy engine was found
+			if (!found) exit(0);
+
+			// Get sampling rate
+			sample_rate = sample_rates[engine.params.sampling_rate_index];
+			main_volume = engine.params.main_vol;
+			song_tbl_ptr = engine.song_table;
+			params_m32 = engine.offset + 32 == uint32_t(engine.main_offset);
+			scanned = true;
 		}
-
-		// Engine parameter's word
-		uint32_t parameter_word;
-		fread(&parameter_word, 4, 1, inGBA);
-
-		// Get sampling rate
-		sample_rate = sample_rates[(parameter_word >> 16) & 0xf];
-		main_volume = (parameter_word >> 12) & 0xf;
-
-		// Compute address of song table
-		uint32_t song_levels;			// Read # of song levels
-		fread(&song_levels, 4, 1, inGBA);
-		printf("# of song levels: %d\n", song_levels);
-		song_tbl_ptr = get_GBA_pointer() + 12 * song_levels;
 	}
 
-	// Create a directory named like the input ROM, without the .gba extention
-	mkdir(outPath);
-
-	//  Get the size of the input GBA file
-	fseek(inGBA, 0L, SEEK_END);
-	inGBA_size = ftell(inGBA);
-
 	if (song_tbl_ptr >= inGBA_size)
 	{
 		fprintf(stderr, "Fatal error: Song table at 0x%x is past the end of the file.\n", song_tbl_ptr);
@@ -241,8 +364,6 @@ int main(int argc, char *const argv[])
 	printf("Parsing song table...");
 	// New list of songs
 	std::vector<uint32_t> song_list;
-	// New list of sound banks
-	std::set<uint32_t> sound_bank_list;
 
 	if (fseek(inGBA, song_tbl_ptr, SEEK_SET))
 	{
@@ -253,10 +374,11 @@ int main(int argc, char *const argv[])
 	// Ignores entries which are made of 0s at the start of the song table
 	// this fix was necessarily for the game Fire Emblem
 	uint32_t song_pointer;
+	uint32_t first_tbl_ptr = song_tbl_ptr;
 	while (true)
 	{
 		fread(&song_pointer, 4, 1, inGBA);
-		if (song_pointer != 0) break;
+		if (song_pointer != 0 || !skip_zeros) break;
 		song_tbl_ptr += 4;
 	}
 
@@ -278,49 +400,114 @@ int main(int argc, char *const argv[])
 	// End of song table
 	uint32_t song_tbl_end_ptr = 8*i + song_tbl_ptr;
 
-	puts("Collecting sound bank list...");
+	// Tell how to skip the detection the next time this game is ripped
+	if (scanned)
+	{
+		game.song_table = first_tbl_ptr;
+		game.sample_rate = sample_rate;
+		game.main_volume = main_volume;
+		game.quirks = song_tbl_ptr != first_tbl_ptr ? QUIRK_LEADING_ZEROS : 0;
+		if (params_m32) game.quirks |= QUIRK_PARAMS_M32;
+		printf("Add this line to known_games.txt to skip detection of this game: %s\n", known_game_line(game).c_str());
+	}
 
-	typedef std::set<uint32_t>::iterator bank_t;
-	bank_t *sound_bank_index_list = new bank_t[song_list.size()];
+	// Every pointer of the ROM, to find songs and sound banks without rescanning it
+	PointerIndex pointers(rom.data(), rom.size());
 
-	for (i = 0; i < song_list.size(); i++)
+	// Songs which are present in the ROM but not in the song table are ripped after the others
+	if (us)
 	{
-		// Ignore unused song, which points to the end of the song table (for some reason)
-		if (song_list[i] != song_tbl_end_ptr)
-		{
-			// Seek to song data
-			if (fseek(inGBA, song_list[i] + 4, SEEK_SET)) continue;
-			uint32_t sound_bank_ptr = get_GBA_pointer();
+		std::vector<uint32_t> unused_songs = find_unused_songs(rom, pointers, song_tbl_ptr, song_tbl_end_ptr);
+		printf("Found %u songs which are not referenced by the song table.\n", (unsigned int)unused_songs.size());
+		song_list.insert(song_list.end(), unused_songs.begin(), unused_songs.end());
+	}
 
-			// Add sound bank to list if not already in the list
-			sound_bank_index_list[i] = sound_bank_list.insert(sound_bank_ptr).first;
-		}
+	puts("Collecting sound bank list...");
+	collect_sound_banks(pointers, song_list, song_tbl_end_ptr, index);
+
+	index.song_tbl_ptr = song_tbl_ptr;
+	index.sample_rate = sample_rate;
+	index.main_volume = main_volume;
+	index.songs = song_list;
+}
+
+int main(int argc, char *const argv[])
+{
+	// Parse arguments (without program name)
+	parse_args(argc - 1, argv + 1);
+
+	if (outPath.size() == 0)
+	{
+		outPath = ".";
 	}
 
+	// Compute program prefix (should be "", "./", "../" or whathever)
+	std::string prg_name = argv[0];
+	std::string prg_prefix = prg_name.substr(0, prg_name.rfind(GBA_MUS_RIPPER_NAME));
+
+	//  Get the size of the input GBA file
+	fseek(inGBA, 0L, SEEK_END);
+	inGBA_size = ftell(inGBA);
+	std::vector<uint8_t> rom = read_rom();
+
+	KnownGame game = KnownGame();
+	bool known = !song_tbl_ptr && find_game(rom, prg_prefix, game);
+
+	// Reuse the analysis of a previous rip of this ROM if it was made with the same flags,
+	// and from the same known game entry if there is one (it may have been edited since)
+	RomIndex index;
+	index.rom_hash = rom_index_hash(rom.data(), rom.size());
+	index.flags = us ? 1 : 0;
+	index.manual_tbl_ptr = song_tbl_ptr;
+	std::string game_line = known ? known_game_line(game) : std::string();
+	index.game_hash = uint32_t(rom_index_hash((const uint8_t *)game_line.data(), game_line.size()));
+	std::string index_name = outPath + '/' + name + ".idx";
+	bool indexed = load_rom_index(index_name, index);
+	if (indexed)
+		printf("Using the analysis of %s from %s\n", name.c_str(), index_name.c_str());
+	else
+		analyze_rom(rom, game, known, index);
+
 	// Close GBA file so that SongRipper can access it
 	fclose(inGBA);
 
+	// Create a directory named like the input ROM, without the .gba extention
+	mkdir(outPath);
+	if (!indexed && !save_rom_index(index_name, index))
+		fprintf(stderr, "Warning: Can't write the analysis of the ROM to %s\n", index_name.c_str());
+
+	int sample_rate = index.sample_rate, main_volume = index.main_volume;
+	const std::vector<uint32_t>& song_list = index.songs;
+	const std::vector<uint32_t>& sound_bank_list = index.banks;
+
+	// Songs record the instruments they use in this file, which is then used to trim the soundfont(s)
+	std::string usage_name = outPath + "/usage.txt";
+	if (trim) remove(usage_name.c_str());
+
 	// Create directories for each sound bank if separate banks is enabled
 	if (sb)
 	{
-		for (bank_t j = sound_bank_list.begin(); j != sound_bank_list.end(); ++j)
+		for (unsigned int d = 0; d < sound_bank_list.size(); d++)
 		{
-			unsigned int d = std::distance(sound_bank_list.begin(), j);
 			std::string subdir = outPath + '/' + "soundbank_" + dec4(d);
 			mkdir(subdir);
 		}
 	}
 
-	for (i = 0; i < song_list.size(); i++)
+	// Usage files of songs, which sound_font_ripper turns into their soundfonts if per song is enabled
+	std::vector<std::string> song_usage_names;
+
+	for (unsigned int i = 0; i < song_list.size(); i++)
 	{
-		if (song_list[i] != song_tbl_end_ptr)
+		if (index.song_banks[i] != ROM_INDEX_NO_BANK)
 		{
-			unsigned int bank_index = distance(sound_bank_list.begin(), sound_bank_index_list[i]);
-			std::string seq_rip_cmd = prg_prefix + SONG_RIPPER_NAME + " \"" + inGBA_path + "\" \"" + outPath;
+			unsigned int bank_index = index.song_banks[i];
 
 			// Add leading zeroes to file name
-			if (sb) seq_rip_cmd += "/soundbank_" + dec4(bank_index);
-			seq_rip_cmd += "/song" + dec4(i) + ".mid\"";
+			std::string song_name = outPath;
+			if (sb) song_name += "/soundbank_" + dec4(bank_index);
+			song_name += "/song" + dec4(i);
+			std::string seq_rip_cmd = prg_prefix + SONG_RIPPER_NAME + " \"" + inGBA_path + "\" \"" + song_name + ".mid\"";
 
 			seq_rip_cmd += " 0x" + hex(song_list[i]);
 			seq_rip_cmd += rc ? " -rc" : (xg ? " -xg": " -gs");
@@ -330,8 +517,18 @@ int main(int argc, char *const argv[])
 				seq_rip_cmd += " -lv";
 			}
 			// Bank number, if banks are not separated
-			if (!sb)
+			if (!sb && !ps)
 				seq_rip_cmd += " -b" + std::to_string(bank_index);
+			if (ps)
+			{
+				// The song's own usage file, song_ripper appends to it
+				std::string song_usage_name = song_name + ".usage";
+				remove(song_usage_name.c_str());
+				seq_rip_cmd += " \"-u" + song_usage_name + '"';
+				song_usage_names.push_back(song_usage_name);
+			}
+			else if (trim)
+				seq_rip_cmd += " \"-u" + usage_name + '"';
 
 			printf("Song %u\n", i);
 
@@ -339,28 +536,51 @@ int main(int argc, char *const argv[])
 			if (!system(seq_rip_cmd.c_str())) puts("An error occurred while calling song_ripper.");
 		}
 	}
-	delete[] sound_bank_index_list;
 
-	if (sb)
+	bool ripped = true;
+	if (ps)
 	{
-		// Rips each sound bank in a different file/folder
-		for (bank_t j = sound_bank_list.begin(); j != sound_bank_list.end(); ++j)
-		{
-			unsigned int bank_index = distance(sound_bank_list.begin(), j);
+		// Rips the instruments of each song in a different file, all at once
+		std::string sf_rip_args = prg_prefix + SOUND_FRONT_RIPPER_NAME + " \"" + inGBA_path + '"';
+		if (sample_rate) sf_rip_args += " -s" + std::to_string(sample_rate);
+		if (main_volume) sf_rip_args += " -mv" + std::to_string(main_volume);
+		if (gm) sf_rip_args += " -gm";
 
-			std::string sbnumber = dec4(bank_index);
-			std::string foldername = "soundbank_" + sbnumber;
-			std::string sf_rip_args = prg_prefix + SOUND_FRONT_RIPPER_NAME + " \"" + inGBA_path + "\" \"" + outPath + '/';
-			sf_rip_args += foldername + '/' + foldername /* + "_@" + hex(*j) */ + ".sf2\"";
+		// The usage files are given in a list file, there can be too many for a command line
+		std::string usage_list_name = outPath + "/usage_list.txt";
+		FILE *usage_list = fopen(usage_list_name.c_str(), "w");
+		if (usage_list)
+		{
+			for (unsigned int j = 0; j < song_usage_names.size(); j++)
+				fprintf(usage_list, "%s\n", song_usage_names[j].c_str());
+			fclose(usage_list);
+			sf_rip_args += " \"-ps@" + usage_list_name + '"';
+			ripped = call_sound_font_ripper(sf_rip_args);
+			remove(usage_list_name.c_str());
+		}
+		else
+		{
+			fprintf(stderr, "Can't write to file: %s\n", usage_list_name.c_str());
+			ripped = false;
+		}
 
-			if (sample_rate) sf_rip_args += " -s" + std::to_string(sample_rate);
-			if (main_volume)	sf_rip_args += " -mv" + std::to_string(main_volume);
-			if (gm) sf_rip_args += " -gm";
-			sf_rip_args += " 0x" + hex(*j);
+		for (unsigned int j = 0; j < song_usage_names.size(); j++)
+			remove(song_usage_names[j].c_str());
+	}
+	else if (sb)
+	{
+		// Rips each sound bank in a different file/folder, all at once
+		// sound_font_ripper names the files after the folders created above
+		std::string sf_rip_args = prg_prefix + SOUND_FRONT_RIPPER_NAME + " \"" + inGBA_path + "\" \"" + outPath + "\" -sb";
+		if (sample_rate) sf_rip_args += " -s" + std::to_string(sample_rate);
+		if (main_volume) sf_rip_args += " -mv" + std::to_string(main_volume);
+		if (gm) sf_rip_args += " -gm";
+		if (trim) sf_rip_args += " \"-u" + usage_name + '"';
+		for (unsigned int j = 0; j < sound_bank_list.size(); j++)
+			sf_rip_args += " 0x" + hex(sound_bank_list[j]);
 
-            printf("DEBUG: Goint to call system(%s)\n", sf_rip_args.c_str());
-			system(sf_rip_args.c_str());
-		}
+		printf("DEBUG: Going to call system(%s)\n", sf_rip_args.c_str());
+		ripped = call_sound_font_ripper(sf_rip_args);
 	}
 	else
 	{
@@ -372,16 +592,18 @@ int main(int argc, char *const argv[])
 		if (main_volume) sf_rip_args += " -mv" + std::to_string(main_volume);
 		// Pass -gm argument if necessary
 		if (gm) sf_rip_args += " -gm";
+		if (trim) sf_rip_args += " \"-u" + usage_name + '"';
 
 		// Make sound banks addresses list.
-		for (bank_t j = sound_bank_list.begin(); j != sound_bank_list.end(); ++j)
-			sf_rip_args += " 0x" + hex(*j);
+		for (unsigned int j = 0; j < sound_bank_list.size(); j++)
+			sf_rip_args += " 0x" + hex(sound_bank_list[j]);
 
 		// Call sound font ripper
         printf("DEBUG: Going to call system(%s)\n", sf_rip_args.c_str());
-		system(sf_rip_args.c_str());
+		ripped = call_sound_font_ripper(sf_rip_args);
 	}
 
+	if (!ripped) return -1;
 	puts("Rip completed!");
 	return 0;
 }
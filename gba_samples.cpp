@@ -8,32 +8,95 @@
  */
 
 #include "gba_samples.hpp"
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
-#include <cstdio>
 #include "hex_string.hpp"
+#include "pcm_cache.hpp"
+#include <map>
+#include <memory>
+#include <vector>
 
-extern FILE *inGBA;
-extern FILE *psg_data;
-extern FILE *goldensun_synth;
+// Golden Sun's synth waveforms, 64 unsigned 8-bit samples per cycle
+struct gs_synth_waves
+{
+	uint8_t saw[64];
+	uint8_t triangle[64];
+	// Square waves of each duty cycle, in 64ths
+	uint8_t square[64][64];
 
-int GBASamples::build_sample(uint32_t pointer)
-{	// Do nothing if sample already exists
-	for (int i=samples_list.size()-1; i >= 0; --i)
-		if (samples_list[i] == pointer) return i;
+	gs_synth_waves()
+	{
+		for (int j = 0; j < 64; j++)
+		{
+			saw[j] = 4 * j;
+			triangle[j] = j < 32 ? 8 * j : 8 * (63 - j);
+			for (int k = 0; k < 64; k++)
+				square[k][j] = square_sample(j, k);
+		}
+	}
 
-	// Read sample data
-	if (fseek(inGBA, pointer, SEEK_SET)) throw -1;
+	// Sample j of a cycle of a square wave whose duty cycle position is k (0-127),
+	// it's high from 0 to k for k = 0 to 64, then from k-64 to 64
+	static uint8_t square_sample(int j, int k)
+	{
+		return ((j - k) & 127) >= 64 ? 192 : 64;
+	}
+};
+
+static const gs_synth_waves& get_gs_synth_waves()
+{
+	// Generated the first time they're needed, thread safe
+	static const gs_synth_waves waves;
+	return waves;
+}
 
-	struct
+// Golden Sun's square waves with a variable duty cycle, by (duty_cycle, change_speed, sample_rate)
+// They're kept until the program ends, and shared by all SF2 files
+static PcmCacheMutex gs_pwm_mutex;
+static std::map<uint64_t, std::unique_ptr<std::vector<uint8_t>>> gs_pwm_waves;
+
+// The duty cycle position is an 8-bit accumulator which starts at duty_cycle >> 1 and
+// is increased by change_speed on every frame (59.7275 times per second), the cycle
+// is played at sample_rate/64 Hz at the root key. The waveform is generated for one
+// period of the accumulator, rounded to whole cycles, so that it loops without a jump
+// of the duty cycle. That period is long: for an odd change_speed it's 256 frames
+// (4.3 seconds), 1477 cycles or 94.5k samples at 22050 Hz, where a fixed 8192-sample
+// slice used to be written. It's kept, as each (duty_cycle, change_speed) pair is
+// written once per SF2 file and the games only use a few of them.
+static const std::vector<uint8_t>& get_gs_pwm_wave(uint8_t duty_cycle, uint8_t change_speed, uint32_t sample_rate)
+{
+	uint64_t key = uint64_t(sample_rate) << 16 | duty_cycle << 8 | change_speed;
+	std::lock_guard<PcmCacheMutex> lock(gs_pwm_mutex);
+	std::unique_ptr<std::vector<uint8_t>>& wave = gs_pwm_waves[key];
+	if (wave) return *wave;
+
+	// The accumulator comes back to its start after 256 frames, divided by the largest power of 2 of change_speed
+	uint32_t frames = 256;
+	for (unsigned int speed = change_speed; !(speed & 1); speed >>= 1) frames >>= 1;
+	uint32_t cycles = std::max(1u, uint32_t(round(frames * sample_rate / (59.7275 * 64))));
+	uint32_t size = 64 * cycles;
+
+	wave.reset(new std::vector<uint8_t>(size));
+	for (uint32_t n = 0; n < size; n++)
 	{
-		uint32_t loop;
-		uint32_t pitch;
-		uint32_t loop_pos;
-		uint32_t len;
+		uint32_t frame = uint64_t(n) * frames / size;
+		uint8_t position = (duty_cycle >> 1) + frame * change_speed;
+		(*wave)[n] = gs_synth_waves::square_sample(n & 63, position >> 1);
 	}
-	hdr;
-	fread(&hdr, 4, 4, inGBA);
+	return *wave;
+}
+
+int GBASamples::build_sample(const SampleHeader& hdr)
+{	// Do nothing if sample already exists
+	uint32_t pointer = hdr.pointer;
+	SampleKey key = {SampleKey::ROM, pointer};
+	SampleIndexes *found = samples_map.find(key);
+	if (found) return found->index[0];
+
+	if (!hdr.valid) throw -1;
+	const DataView& rom = data.rom;
+	uint32_t loop_pos = hdr.loop_pos;
 
 	//Now we should make sure the data is coherent, and reject
 	//the samples if errors are suspected
@@ -61,39 +124,44 @@ int GBASamples::build_sample(uint32_t pointer)
 	unsigned int pitch_correction = int((int_delta_note - delta_note) * 100);
 	unsigned int original_pitch = 60 + (int)int_delta_note;
 
+	int index;
+
 	// Detect Golden Sun samples
-	if (goldensun_synth && hdr.len == 0 && hdr.loop_pos == 0)
+	if (hdr.len == 0 && hdr.loop_pos == 0)
 	{
-		if (fgetc(inGBA) != 0x80) throw -1;
-		uint8_t type = fgetc(inGBA);
+		if (hdr.synth[0] != 0x80) throw -1;
+		uint8_t type = hdr.synth[1];
 		switch (type)
 		{
 			case 0:		// Square wave
 			{
 				std::string name = "Square @0x" + hex(pointer);
-				uint8_t duty_cycle = fgetc(inGBA);
-				uint8_t change_speed = fgetc(inGBA);
+				uint8_t duty_cycle = hdr.synth[2];
+				uint8_t change_speed = hdr.synth[3];
 				if (change_speed == 0)
 				{	// Square wave with constant duty cycle
-					unsigned int base_pointer = 128 + 64 * (duty_cycle >> 2);
-					sf2->add_new_sample(goldensun_synth, UNSIGNED_8, name.c_str(), base_pointer, 64, true, 0, original_pitch, pitch_correction);
+					DataView wave(get_gs_synth_waves().square[duty_cycle >> 2], 64);
+					index = sf2->add_new_sample(wave, UNSIGNED_8, name.c_str(), 0, 64, true, 0, original_pitch, pitch_correction);
 				}
 				else
-				{	// Sqaure wave with variable duty cycle, not exact, but sounds close enough
-					sf2->add_new_sample(goldensun_synth, UNSIGNED_8, name.c_str(), 128, 8192, true, 0, original_pitch, pitch_correction);
+				{	// Square wave with variable duty cycle, exact at the root key
+					DataView wave(get_gs_pwm_wave(duty_cycle, change_speed, sf2->default_sample_rate));
+					index = sf2->add_new_sample(wave, UNSIGNED_8, name.c_str(), 0, wave.size(), true, 0, original_pitch, pitch_correction);
 				}
 			}	break;
 
 			case 1:		// Saw wave
 			{
 				std::string name = "Saw @0x" + hex(pointer);
-				sf2->add_new_sample(goldensun_synth, UNSIGNED_8, name.c_str(), 0, 64, true, 0, original_pitch, pitch_correction);
+				DataView wave(get_gs_synth_waves().saw, 64);
+				index = sf2->add_new_sample(wave, UNSIGNED_8, name.c_str(), 0, 64, true, 0, original_pitch, pitch_correction);
 			}	break;
 
 			case 2:		// Triangle wave
 			{
 				std::string name = "Triangle @0x" + hex(pointer);
-				sf2->add_new_sample(goldensun_synth, UNSIGNED_8, name.c_str(), 64, 64, true, 0, original_pitch, pitch_correction);
+				DataView wave(get_gs_synth_waves().triangle, 64);
+				index = sf2->add_new_sample(wave, UNSIGNED_8, name.c_str(), 0, 64, true, 0, original_pitch, pitch_correction);
 			}	break;
 
 			default :
@@ -106,89 +174,173 @@ int GBASamples::build_sample(uint32_t pointer)
 		if (hdr.len < 16 || hdr.len > 0x3FFFFF) throw -1;
 
 		//Prevent samples with illegal loop point from happening
-		if (hdr.loop_pos > hdr.len-8)
+		if (loop_pos > hdr.len-8)
 		{
 			puts("Warning : Illegal loop point detected\n");
-			hdr.loop_pos = 0;
+			loop_pos = 0;
 		}
 
 		// Create (poetic) instrument name
 		std::string name = (bdpcm_en ? "BDPCM @0x" : "Sample @0x") + hex(pointer);
 
 		// Add the sample to output
-		sf2->add_new_sample(inGBA, bdpcm_en ? BDPCM : SIGNED_8, name.c_str(), pointer + 16, hdr.len, loop_en, hdr.loop_pos, original_pitch, pitch_correction);
+		index = sf2->add_new_sample(rom, bdpcm_en ? BDPCM : SIGNED_8, name.c_str(), pointer + 16, hdr.len, loop_en, loop_pos, original_pitch, pitch_correction);
 	}
-	samples_list.push_back(pointer);
-	return samples_list.size() - 1;
+	SampleIndexes indexes = {{index}};
+	samples_map.insert(key, indexes);
+	return index;
 }
 
 //Build game boy channel 3 sample
-int GBASamples::build_GB3_samples(uint32_t pointer)
+void GBASamples::build_GB3_samples(uint32_t pointer, int sample_index[4])
 {
 	// Do nothing if sample already exists
-	for (int i=samples_list.size()-1; i >= 0; --i)
-		if (samples_list[i] == pointer) return i;
+	SampleKey key = {SampleKey::GB3, pointer};
+	SampleIndexes *found = samples_map.find(key);
+	if (found)
+	{
+		std::copy(found->index, found->index + 4, sample_index);
+		return;
+	}
 
 	std::string name = "GB3 @0x" + hex(pointer);
 
-	sf2->add_new_sample(inGBA, GAMEBOY_CH3, (name + 'A').c_str(), pointer, 256, true, 0, 53, 24, 22050);
-	sf2->add_new_sample(inGBA, GAMEBOY_CH3, (name + 'B').c_str(), pointer, 128, true, 0, 65, 24, 22050);
-	sf2->add_new_sample(inGBA, GAMEBOY_CH3, (name + 'C').c_str(), pointer, 64, true, 0, 77, 24, 22050);
-	sf2->add_new_sample(inGBA, GAMEBOY_CH3, (name + 'D').c_str(), pointer, 32, true, 0, 89, 24, 22050);
+	sample_index[0] = sf2->add_new_sample(data.rom, GAMEBOY_CH3, (name + 'A').c_str(), pointer, 256, true, 0, 53, 24, 22050);
+	sample_index[1] = sf2->add_new_sample(data.rom, GAMEBOY_CH3, (name + 'B').c_str(), pointer, 128, true, 0, 65, 24, 22050);
+	sample_index[2] = sf2->add_new_sample(data.rom, GAMEBOY_CH3, (name + 'C').c_str(), pointer, 64, true, 0, 77, 24, 22050);
+	sample_index[3] = sf2->add_new_sample(data.rom, GAMEBOY_CH3, (name + 'D').c_str(), pointer, 32, true, 0, 89, 24, 22050);
 
-	// We have to to add multiple entries to have the size of the list in sync
-	// with the numeric indexes of samples....
-	for (int i=4; i!=0; --i) samples_list.push_back(pointer);
-	return samples_list.size() - 1;
+	SampleIndexes indexes;
+	std::copy(sample_index, sample_index + 4, indexes.index);
+	samples_map.insert(key, indexes);
 }
 
-//Build square wave sample
-int GBASamples::build_pulse_samples(unsigned int duty_cycle)
-{	// Do nothing if sample already exists
-	for (int i=samples_list.size()-1; i >= 0; --i)
-		if (samples_list[i] == duty_cycle) return i;
+// GameBoy pulse channel waveforms: a single cycle of each duty cycle for each key range,
+// band-limited so that the highest key of the range doesn't alias at 44100 Hz.
+// They're generated once, and shared by all SF2 files.
+struct gb_pulse_waves
+{
+	// Signed 16-bit little endian samples, the cycle of range i is 512 >> i samples long
+	std::vector<uint8_t> wave[4][PULSE_RANGES];
+	// 512 samples per cycle at key 36 (65.4 Hz), and so for every range
+	uint32_t sample_rate;
 
-	std::string name = "square ";
-	switch (duty_cycle)
+	gb_pulse_waves()
 	{
-		case 0:
-			name += "12.5%";
-			break;
+		const double key36_freq = 440.0 * pow(2.0, (36 - 69) / 12.0);
+		sample_rate = uint32_t(round(512 * key36_freq));
 
-		default:
-			name += "25%";
-			break;
+		const double duty_cycles[4] = {0.125, 0.25, 0.5, 0.75};
+		for (int duty = 0; duty < 4; duty++)
+			for (int i = 0; i < PULSE_RANGES; i++)
+			{
+				// Harmonics up to the Nyquist frequency at the highest key of the range
+				int high_key = i == PULSE_RANGES-1 ? 127 : 41 + 12*i;
+				double high_freq = 440.0 * pow(2.0, (high_key - 69) / 12.0);
+				int length = 512 >> i;
+				int harmonics = std::min(length/2 - 1, int(22050 / high_freq));
+				generate(wave[duty][i], duty_cycles[duty], length, std::max(harmonics, 1));
+			}
+	}
 
-		case 2:
-			name += "50%";
-			break;
+	static void generate(std::vector<uint8_t>& wave, double duty, int length, int harmonics)
+	{
+		wave.resize(2 * length);
+		for (int j = 0; j < length; j++)
+		{
+			// Fourier series of a pulse, high from 0 to duty, without DC
+			double t = double(j) / length;
+			double x = 0;
+			for (int h = 1; h <= harmonics; h++)
+				x += 2 / (h * M_PI) * sin(h * M_PI * duty) * cos(2 * M_PI * h * t - h * M_PI * duty);
+
+			// As loud as the old recordings, which were 28000 from low to high
+			int16_t sample = int16_t(round(28000 * x));
+			wave[2*j] = uint8_t(sample);
+			wave[2*j+1] = uint8_t(sample >> 8);
+		}
 	}
+};
 
-	//This data is referenced to my set of recordings
-	//stored in "psg_data.raw"
-	const int pointer_tbl[3][5] =
+static const gb_pulse_waves& get_pulse_waves()
+{
+	// Generated the first time they're needed, thread safe
+	static const gb_pulse_waves waves;
+	return waves;
+}
+
+//Build square wave sample
+void GBASamples::build_pulse_samples(unsigned int duty_cycle, int sample_index[PULSE_RANGES])
+{	// Do nothing if sample already exists
+	SampleKey key = {SampleKey::PULSE, duty_cycle};
+	SampleIndexes *found = samples_map.find(key);
+	if (found)
 	{
-			{0x0000, 0x2166, 0x3c88, 0x4bd2, 0x698a},
-			{0x7798, 0x903e, 0xa15e, 0xb12c, 0xbf4a},
-			{0xc958, 0xe200, 0xf4ec, 0x10534, 0x11360}
-	};
+		std::copy(found->index, found->index + PULSE_RANGES, sample_index);
+		return;
+	}
+
+	const char *const duty_names[4] = {"12.5%", "25%", "50%", "75%"};
+	std::string name = std::string("square ") + duty_names[duty_cycle & 3];
 
-	const int size_tbl[3][5] =
+	const gb_pulse_waves& waves = get_pulse_waves();
+	for (int i = 0; i < PULSE_RANGES; i++)
 	{
-			{0x10b3, 0xd91, 0x7a5, 0xdec, 0x707},
-			{0xc53, 0x890, 0x7e7, 0x70f, 0x507},
-			{0xc54, 0x976, 0x824, 0x716, 0x36b}
-	};
+		const std::vector<uint8_t>& wave = waves.wave[duty_cycle & 3][i];
+		sample_index[i] = sf2->add_new_sample(DataView(wave), SIGNED_16, (name + char('A' + i)).c_str(), 0, wave.size() / 2,
+						  true, 0, 36 + 12 * i, 0, waves.sample_rate);
+	}
+	SampleIndexes indexes;
+	std::copy(sample_index, sample_index + PULSE_RANGES, indexes.index);
+	samples_map.insert(key, indexes);
+}
 
-	const int loop_size[5] = {689, 344, 172, 86, 43};
+// GameBoy noise channel waveforms, for keys 42 to 77
+// The channel outputs the inverted bit 0 of a 15-bit LFSR (7-bit for metallic noise),
+// clocked at 524288 / divisor Hz. They're generated once, and shared by all SF2 files.
+struct gb_noise_waves
+{
+	std::vector<uint8_t> wave[2][36];		// Normal and metallic noise
+	uint32_t sample_rate[36];
 
-	for (int i = 0; i < 5; i++)
+	gb_noise_waves()
 	{
-		sf2->add_new_sample(psg_data, SIGNED_16, (name + char('A' + i)).c_str(), pointer_tbl[duty_cycle][i], size_tbl[duty_cycle][i],
-						  true, size_tbl[duty_cycle][i]-loop_size[i], 36 + 12 * i, 38, 44100);
-		samples_list.push_back(duty_cycle);
+		for (int i = 0; i < 36; i++)
+		{
+			// Divisor of the sound engine's noise table: 4, 7, 6 or 5 times a power of 2
+			uint32_t divisor = (7 - (i+3) % 4) << (10 - (i+3) / 4);
+			// Each LFSR output is held a whole number of samples, so that there are at least 22050 samples per second
+			uint32_t hold = (22050 * divisor + 524287) / 524288;
+			sample_rate[i] = uint32_t(round(524288.0 * hold / divisor));
+
+			// Metallic noise loops on its whole period, normal noise too if it's up to 2 seconds long
+			uint32_t normal_steps = std::min(32767u, 2 * 524288 / divisor);
+			generate(wave[0][i], false, normal_steps, hold);
+			generate(wave[1][i], true, 127, hold);
+		}
+	}
+
+	static void generate(std::vector<uint8_t>& wave, bool metallic, uint32_t steps, uint32_t hold)
+	{
+		wave.resize(steps * hold);
+		unsigned int lfsr = 0x7fff;
+		for (uint32_t i = 0; i < steps; i++)
+		{
+			// Unsigned 8-bit output, about as loud as the old recordings
+			std::fill_n(wave.begin() + i * hold, hold, (lfsr & 1) ? 0x48 : 0xb8);
+
+			unsigned int bit = (lfsr ^ (lfsr >> 1)) & 1;
+			lfsr = (lfsr >> 1) | (bit << 14);
+			if (metallic) lfsr = (lfsr & ~0x40u) | (bit << 6);
+		}
 	}
-	return samples_list.size()-1;
+};
+
+static const gb_noise_waves& get_noise_waves()
+{
+	// Generated the first time they're needed, thread safe
+	static const gb_noise_waves waves;
+	return waves;
 }
 
 //Build white noise sample
@@ -198,39 +350,18 @@ int GBASamples::build_noise_sample(bool metallic, int key)
 	if (key < 42) key = 42;
 	if (key > 77) key = 76;
 
-	unsigned int num = metallic ? 3 + (key-42) : 80 + (key-42);
-
 	// Do nothing if sample already exists
-	for (int i=samples_list.size()-1; i >= 0; --i)
-		if (samples_list[i] == num) return i;
+	SampleKey sample_key = {SampleKey::NOISE, uint32_t(key) | (metallic ? 0x100 : 0)};
+	SampleIndexes *found = samples_map.find(sample_key);
+	if (found) return found->index[0];
 
 	std::string name = std::string("Noise ") + std::string(metallic ? "metallic " : "normal ") + std::to_string(key);
 
-	const int pointer_tbl[] =
-	{
-		72246, 160446, 248646, 336846, 425046, 513246, 601446, 689646, 777846,
-		866046, 954246, 1042446, 1130646, 1218846, 1307046, 1395246, 1483446, 1571646, 1659846,
-		1748046, 1836246, 1924446, 2012646, 2100846, 2189046, 2277246, 2387493, 2475690, 2552863,
-		2619011, 2674134, 2718233, 2756819, 2789893, 2817455, 2839504, 2856041, 2867066, 2872578
-	};
+	const gb_noise_waves& waves = get_noise_waves();
+	const std::vector<uint8_t>& wave = waves.wave[metallic][key-42];
+	int index = sf2->add_new_sample(DataView(wave), UNSIGNED_8, name.c_str(), 0, wave.size(), true, 0, key, 0, waves.sample_rate[key-42]);
 
-	const int normal_len_tbl[] =
-	{
-		88200, 88200, 88200, 88200, 88200, 88200, 88200, 88200, 88200, 88200,
-		88200, 88200, 88200, 88200, 88200, 88200, 88200, 88200, 88200, 88200, 88200, 88200, 88200,
-		88200, 88200, 110247, 88197, 77173, 66148, 55123, 44099, 38586, 33074, 27562, 22049, 16537,
-		11025, 5512, 2756
-	};
-
-	const int metallic_len_tbl[] =
-	{	43755, 38286, 32817, 27347, 21878, 19143, 16408, 13674, 10939, 9572,
-		8204, 6837, 5469, 4786, 4102, 3418, 2735, 2393, 2051, 1709, 1367, 1196, 1026, 855, 684,
-		598, 513,	427, 342, 299, 256, 214, 171, 150, 128, 107, 85, 64
-	};
-
-	sf2->add_new_sample(psg_data, UNSIGNED_8, name.c_str(), pointer_tbl[key-42],
-					  metallic ? metallic_len_tbl[key-42] : normal_len_tbl[key-42], true, 0, key, 0, 44100);
-
-	samples_list.push_back(num);
-	return samples_list.size() - 1;
+	SampleIndexes indexes = {{index}};
+	samples_map.insert(sample_key, indexes);
+	return index;
 }
@@ -8,24 +8,70 @@
 #pragma once
 
 #include "sf2.hpp"
-#include <vector>
+#include "bank_graph.hpp"
+#include "hash_map.hpp"
+
+// Files the samples are converted from: the GBA ROM (Game Boy and Golden Sun synth
+// samples are generated)
+struct GBASoundData
+{
+	DataView rom;
+};
+
+// Samples which are already converted: a sample within the .gba file, or a Game Boy sample
+struct SampleKey
+{
+	enum Kind : uint8_t
+	{
+		ROM,			// id is the pointer to the sample
+		GB3,			// id is the pointer to the wave data
+		PULSE,			// id is the duty cycle
+		NOISE			// id is the key, plus 0x100 for metallic noise
+	} kind;
+	uint32_t id;
+
+	bool operator ==(const SampleKey& k) const
+	{
+		return kind == k.kind && id == k.id;
+	}
+};
+
+struct SampleKeyHash
+{
+	uint32_t operator ()(const SampleKey& k) const
+	{
+		return hash_mix(k.id * 4 + k.kind);
+	}
+};
+
+// Game Boy pulse samples: one per octave, the one of range i has its root key at 36 + 12*i
+// and is used from 6 keys below to 5 keys above (from key 0 for the first, to key 127 for the last)
+#define PULSE_RANGES 8
+
+// # of the corresponding samples in .sf2, one per key range for Game Boy samples
+struct SampleIndexes
+{
+	int index[PULSE_RANGES];
+};
 
 class GBASamples
-{	// List of pointers to samples within the .gba file, position is # of sample in .sf2
-	std::vector<uint32_t> samples_list;
+{
+	OpenHashMap<SampleKey, SampleIndexes, SampleKeyHash> samples_map;
 	// Related sf2 class
 	SF2 *sf2;
+	// Related data files
+	GBASoundData data;
 
 public:
-	GBASamples(SF2 *sf2) : sf2(sf2)
+	GBASamples(SF2 *sf2, const GBASoundData& data) : sf2(sf2), data(data)
 	{}
 
-	// Convert a normal sample to SoundFont format
-	int build_sample(uint32_t pointer);
-	// Convert a Game Boy channel 3 sample to SoundFont format
-	int build_GB3_samples(uint32_t pointer);
-	// Convert a Game Boy pulse (channels 1, 2) sample
-	int build_pulse_samples(unsigned int duty_cycle);
+	// Convert a normal sample to SoundFont format, from its header read in the bank graph
+	int build_sample(const SampleHeader& hdr);
+	// Convert a Game Boy channel 3 sample to SoundFont format, one sample per key range
+	void build_GB3_samples(uint32_t pointer, int sample_index[4]);
+	// Convert a Game Boy pulse (channels 1, 2) sample, one sample per key range
+	void build_pulse_samples(unsigned int duty_cycle, int sample_index[PULSE_RANGES]);
 	// Convert a Game Boy noise (channel 4) sample
 	int build_noise_sample(bool metallic, int key);
 };
@@ -0,0 +1,89 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Small open addressing hash map (linear probing, power of 2 capacity) used to cache
+ * the instruments and samples which are already converted.
+ * Entries are never removed, so no tombstones are needed.
+ * Keys need an operator== and a hash functor returning a well mixed uint32_t.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Final mix of MurmurHash3, spreads the bits of a 32-bit value over the whole hash
+static inline uint32_t hash_mix(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+template <class Key, class Value, class Hash>
+class OpenHashMap
+{
+	struct Slot
+	{
+		Key key;
+		Value value;
+		bool used;
+	};
+
+	std::vector<Slot> slots;
+	size_t count;
+
+	// Slot containing key, or the empty slot where it should be inserted
+	size_t find_slot(const Key& key) const
+	{
+		size_t mask = slots.size() - 1;
+		size_t i = Hash()(key) & mask;
+		while (slots[i].used && !(slots[i].key == key))
+			i = (i + 1) & mask;
+		return i;
+	}
+
+	void grow()
+	{
+		std::vector<Slot> old(slots.size() ? 2 * slots.size() : 16);
+		old.swap(slots);
+		for (const Slot& s : old)
+			if (s.used) slots[find_slot(s.key)] = s;
+	}
+
+public:
+	OpenHashMap() : count(0)
+	{}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	// Pointer to the value of key, nullptr if it isn't in the map
+	Value *find(const Key& key)
+	{
+		if (slots.empty()) return nullptr;
+		Slot& s = slots[find_slot(key)];
+		return s.used ? &s.value : nullptr;
+	}
+
+	// Add key to the map or replace its value
+	void insert(const Key& key, const Value& value)
+	{
+		// Keep the load factor under 3/4
+		if (4 * (count + 1) > 3 * slots.size()) grow();
+		Slot& s = slots[find_slot(key)];
+		if (!s.used)
+		{
+			s.key = key;
+			s.used = true;
+			++count;
+		}
+		s.value = value;
+	}
+};
@@ -0,0 +1,177 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Buffered JSON formatter: values are appended to a memory buffer, with the commas
+ * between them, and the buffer is written to the file in large blocks.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class JsonWriter
+{
+	FILE *out;
+	std::string buf;
+	std::vector<bool> first;	// For each open object or array, if nothing is in it yet
+	bool after_key;				// The next value is the value of a key
+	bool line_break;			// The next value starts a new line
+
+	// Comma before a value, if it's not the first of its object or array
+	void separator()
+	{
+		if (after_key)
+			after_key = false;
+		else if (!first.empty())
+		{
+			if (!first.back()) buf += ',';
+			first.back() = false;
+		}
+		if (line_break)
+		{
+			buf += '\n';
+			line_break = false;
+		}
+	}
+
+	void write_string(const char *s)
+	{
+		static const char hex_digits[] = "0123456789abcdef";
+		buf += '"';
+		for (; *s; s++)
+		{
+			unsigned char c = *s;
+			if (c == '"' || c == '\\')
+			{
+				buf += '\\';
+				buf += c;
+			}
+			else if (c < 0x20)
+			{
+				buf += "\\u00";
+				buf += hex_digits[c >> 4];
+				buf += hex_digits[c & 0xf];
+			}
+			else
+				buf += c;
+		}
+		buf += '"';
+	}
+
+	void close(char c)
+	{
+		buf += c;
+		first.pop_back();
+		if (buf.size() >= 0x10000) flush();
+	}
+
+	// Forbid copy and affectation
+	JsonWriter(JsonWriter&);
+	JsonWriter& operator=(JsonWriter&);
+
+public:
+	JsonWriter(FILE *out) : out(out), after_key(false), line_break(false)
+	{
+		buf.reserve(0x11000);
+	}
+
+	~JsonWriter()
+	{
+		flush();
+	}
+
+	// Write what is in the buffer to the file
+	void flush()
+	{
+		fwrite(buf.data(), 1, buf.size(), out);
+		buf.clear();
+	}
+
+	JsonWriter& begin_object()
+	{
+		separator();
+		buf += '{';
+		first.push_back(true);
+		return *this;
+	}
+
+	JsonWriter& end_object()
+	{
+		close('}');
+		return *this;
+	}
+
+	JsonWriter& begin_array()
+	{
+		separator();
+		buf += '[';
+		first.push_back(true);
+		return *this;
+	}
+
+	JsonWriter& end_array()
+	{
+		close(']');
+		return *this;
+	}
+
+	// Key of the next value, within an object
+	JsonWriter& key(const char *k)
+	{
+		separator();
+		write_string(k);
+		buf += ':';
+		after_key = true;
+		return *this;
+	}
+
+	JsonWriter& number(int64_t n)
+	{
+		separator();
+		char digits[20];
+		int len = 0;
+		uint64_t u = n < 0 ? -uint64_t(n) : uint64_t(n);
+		do
+			digits[len++] = '0' + u % 10;
+		while (u /= 10);
+		if (n < 0) buf += '-';
+		while (len) buf += digits[--len];
+		return *this;
+	}
+
+	JsonWriter& boolean(bool b)
+	{
+		separator();
+		buf += b ? "true" : "false";
+		return *this;
+	}
+
+	JsonWriter& string(const char *s)
+	{
+		separator();
+		write_string(s);
+		return *this;
+	}
+
+	JsonWriter& string(const std::string& s)
+	{
+		return string(s.c_str());
+	}
+
+	JsonWriter& null()
+	{
+		separator();
+		buf += "null";
+		return *this;
+	}
+
+	// Start a new line before the next value, to keep long dumps readable
+	void newline()
+	{
+		line_break = true;
+	}
+};
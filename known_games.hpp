@@ -0,0 +1,113 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Table of games whose song table is already known, so that their ROM
+ * doesn't have to be scanned for the sound engine.
+ * Games are identified by the game code, software version and complement check
+ * of their ROM header. Games can be added without recompiling with a "known_games.txt"
+ * file, containing one game per line:
+ *
+ * code version checksum song_table sample_rate main_volume quirks
+ *
+ * for example: ABCE 00 1f 0x1234a8 13379 12 0
+ * All numbers but the sampling rate and main volume are hexadecimal, lines starting
+ * with '#' are ignored. A sampling rate or main volume of 0 means the default value is used.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define GBA_HEADER_SIZE 0xC0
+
+// Quirks of a game's sound engine data
+enum
+{
+	QUIRK_LEADING_ZEROS = 0x01,		// Song table starts with entries made of 0s, they're skipped (Fire Emblem)
+	QUIRK_PARAMS_M32 = 0x02			// Engine parameters are 32 bytes before the main function instead of 16 (Pokémon)
+};
+
+struct KnownGame
+{
+	char code[5];				// Game code (0xAC in ROM header)
+	uint8_t version;			// Software version (0xBC in ROM header)
+	uint8_t checksum;			// Complement check (0xBD in ROM header)
+	uint32_t song_table;		// Offset of the song table
+	uint16_t sample_rate;		// Engine's sampling rate in Hz, 0 if unknown
+	uint8_t main_volume;		// Engine's main volume, 0 if unknown
+	uint8_t quirks;
+};
+
+// Games checked by hand against their ROM, searched before the ones of known_games.txt.
+// The list ends with an empty entry. Lines printed by gba_mus_ripper after a scan
+// go here once checked, as {"code", version, checksum, song_table, sample_rate, main_volume, quirks}.
+static constexpr KnownGame known_games[] =
+{
+	{"", 0, 0, 0, 0, 0, 0}
+};
+
+// Format a game the same way it's written in known_games.txt
+static std::string known_game_line(const KnownGame& game)
+{
+	char line[64];
+	snprintf(line, sizeof(line), "%.4s %02x %02x 0x%x %u %u %x", game.code, game.version, game.checksum,
+		game.song_table, game.sample_rate, game.main_volume, game.quirks);
+	return line;
+}
+
+// Read the additional known games from a file, does nothing if the file doesn't exist
+static void load_known_games(const std::string& filename, std::vector<KnownGame>& games)
+{
+	FILE *f = fopen(filename.c_str(), "r");
+	if (!f) return;
+
+	char line[256];
+	while (fgets(line, sizeof(line), f))
+	{
+		KnownGame game;
+		unsigned int version, checksum, song_table, sample_rate, main_volume, quirks = 0;
+		if (line[0] == '#') continue;
+		if (sscanf(line, "%4s %x %x %x %u %u %x", game.code, &version, &checksum, &song_table, &sample_rate, &main_volume, &quirks) < 6)
+			continue;
+
+		game.version = version;
+		game.checksum = checksum;
+		game.song_table = song_table;
+		game.sample_rate = sample_rate;
+		game.main_volume = main_volume;
+		game.quirks = quirks;
+		games.push_back(game);
+	}
+	fclose(f);
+}
+
+// Fill a table entry with the identification of a ROM header
+static void identify_game(const uint8_t header[GBA_HEADER_SIZE], KnownGame& game)
+{
+	memcpy(game.code, header + 0xAC, 4);
+	game.code[4] = '\0';
+	game.version = header[0xBC];
+	game.checksum = header[0xBD];
+}
+
+// Find the game of a ROM header in the compiled-in table, then in the additional games
+static const KnownGame *find_known_game(const uint8_t header[GBA_HEADER_SIZE], const std::vector<KnownGame>& games)
+{
+	KnownGame id;
+	identify_game(header, id);
+
+	for (const KnownGame *game = known_games; game->code[0]; ++game)
+		if (!memcmp(game->code, id.code, 4) && game->version == id.version && game->checksum == id.checksum)
+			return game;
+
+	for (size_t i = 0; i < games.size(); i++)
+		if (!memcmp(games[i].code, id.code, 4) && games[i].version == id.version && games[i].checksum == id.checksum)
+			return &games[i];
+
+	return nullptr;
+}
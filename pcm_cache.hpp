@@ -0,0 +1,98 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Cache of converted samples, shared by SF2 files built at the same time.
+ * A sample used by several files is converted once, then copied from memory into each file.
+ * Converted samples are kept until the cache is destroyed.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "sf2.hpp"
+#include "hash_map.hpp"
+
+#ifndef _WIN32
+#include <mutex>
+typedef std::mutex PcmCacheMutex;
+#else
+// SF2 files are built one at a time on Windows, no locking is needed
+struct PcmCacheMutex
+{
+	void lock() {}
+	void unlock() {}
+};
+#endif
+
+// A converted sample is identified by its source data and how it's converted
+struct PcmKey
+{
+	const uint8_t *src;
+	SampleType type;
+	uint32_t size;
+	bool loop_flag;
+	uint32_t loop_pos;
+
+	bool operator ==(const PcmKey& k) const
+	{
+		return src == k.src && type == k.type && size == k.size && loop_flag == k.loop_flag && loop_pos == k.loop_pos;
+	}
+};
+
+struct PcmKeyHash
+{
+	uint32_t operator ()(const PcmKey& k) const
+	{
+		return hash_mix(uint32_t(uintptr_t(k.src)) ^ hash_mix(k.size ^ (k.type << 24) ^ hash_mix(k.loop_pos + k.loop_flag)));
+	}
+};
+
+class PcmCache
+{
+	struct Entry
+	{
+		PcmCacheMutex mutex;
+		bool done = false;
+		std::vector<int16_t> pcm;
+	};
+
+	PcmCacheMutex mutex;
+	OpenHashMap<PcmKey, std::shared_ptr<Entry>, PcmKeyHash> entries;
+
+public:
+	// Copy count converted samples of key to out, convert(int16_t*) converts them
+	// in the cache the first time they're needed
+	template <class Convert>
+	void copy(const PcmKey& key, size_t count, int16_t *out, Convert convert)
+	{
+		mutex.lock();
+		std::shared_ptr<Entry> *found = entries.find(key);
+		std::shared_ptr<Entry> entry = found ? *found : std::make_shared<Entry>();
+		if (!found) entries.insert(key, entry);
+		mutex.unlock();
+
+		// Other users of the sample wait until it's converted, then it's never modified
+		entry->mutex.lock();
+		try
+		{
+			if (!entry->done)
+			{
+				entry->pcm.resize(count);
+				convert(entry->pcm.data());
+				entry->done = true;
+			}
+		}
+		catch (...)
+		{
+			entry->mutex.unlock();
+			throw;
+		}
+		entry->mutex.unlock();
+
+		memcpy(out, entry->pcm.data(), 2 * count);
+	}
+};
@@ -0,0 +1,314 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * 8-bit PCM and BDPCM to 16-bit PCM conversion kernels
+ *
+ * Converting a signed 8-bit sample to 16-bit is just putting its byte in the high half
+ * of the output sample, an unsigned sample also needs its sign bit flipped first.
+ * SF2 files are little endian, like all the processors this program runs on.
+ *
+ * BDPCM samples are decoded to 8-bit deltas a byte (two samples) at a time, then
+ * a running sum of the deltas gives the 8-bit samples, which are widened as above.
+ */
+
+#include "pcm_convert.hpp"
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PCM_CONVERT_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define PCM_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+static const int8_t bdpcm_delta_lut[] = {0, 1, 4, 9, 16, 25, 36, 49, -64, -49, -36, -25, -16, -9, -4, -1};
+
+// Deltas of both samples of a BDPCM byte, in the order they're in memory
+// once stored in little endian: delta of the high nibble, then of the low nibble
+struct BdpcmPairTable
+{
+	uint16_t pairs[256];
+
+	BdpcmPairTable()
+	{
+		for (int b = 0; b < 256; b++)
+			pairs[b] = uint8_t(bdpcm_delta_lut[b >> 4]) | (uint8_t(bdpcm_delta_lut[b & 0xf]) << 8);
+	}
+};
+
+void pcm_s8_to_s16_scalar(const uint8_t *src, int16_t *dst, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = uint16_t(src[i] << 8);
+}
+
+void pcm_u8_to_s16_scalar(const uint8_t *src, int16_t *dst, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = uint16_t((src[i] ^ 0x80) << 8);
+}
+
+#ifdef PCM_CONVERT_X86
+
+// 16 samples per iteration, flip is 0x80 to convert unsigned samples
+__attribute__((target("sse2")))
+static size_t convert_sse2(const uint8_t *src, int16_t *dst, size_t count, uint8_t flip)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i sign = _mm_set1_epi8(flip);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i)), sign);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi8(zero, v));
+		_mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpackhi_epi8(zero, v));
+	}
+	return i;
+}
+
+// 32 samples per iteration
+__attribute__((target("avx2")))
+static size_t convert_avx2(const uint8_t *src, int16_t *dst, size_t count, uint8_t flip)
+{
+	const __m128i sign = _mm_set1_epi8(flip);
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32)
+	{
+		__m128i lo = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i)), sign);
+		__m128i hi = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i + 16)), sign);
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_slli_epi16(_mm256_cvtepu8_epi16(lo), 8));
+		_mm256_storeu_si256((__m256i*)(dst + i + 16), _mm256_slli_epi16(_mm256_cvtepu8_epi16(hi), 8));
+	}
+	return i;
+}
+
+// Running sum of 16 bytes in log2(16) shifted additions, plus the sum of the previous bytes,
+// then widened to 16-bit samples. Returns the sum of all bytes so far in every byte.
+__attribute__((target("sse2")))
+static inline __m128i prefix_sum_sse2(__m128i v, __m128i carry, int16_t *dst)
+{
+	v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+	v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+	v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+	v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+	v = _mm_add_epi8(v, carry);
+	_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi8(_mm_setzero_si128(), v));
+	_mm_storeu_si128((__m128i*)(dst + 8), _mm_unpackhi_epi8(_mm_setzero_si128(), v));
+	// Broadcast the last byte
+	return _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_unpackhi_epi8(v, v), 0xff), 0xff);
+}
+
+// One BDPCM block per iteration: the deltas of its 64 samples are looked up a byte at a time,
+// then summed 16 at a time
+__attribute__((target("sse2")))
+static void bdpcm_sse2(const uint8_t *src, int16_t *dst, size_t nblocks, const uint16_t *pairs)
+{
+	for (size_t block = 0; block < nblocks; ++block, src += 33, dst += 64)
+	{
+		uint16_t deltas[32] __attribute__((aligned(16)));
+		deltas[0] = src[0] | (uint8_t(bdpcm_delta_lut[src[1] & 0xf]) << 8);
+		for (unsigned int j = 1; j < 32; ++j)
+			deltas[j] = pairs[src[j+1]];
+
+		__m128i carry = _mm_setzero_si128();
+		for (unsigned int j = 0; j < 4; ++j)
+			carry = prefix_sum_sse2(_mm_load_si128((const __m128i*)deltas + j), carry, dst + 16*j);
+	}
+}
+
+typedef size_t (*convert_kernel)(const uint8_t*, int16_t*, size_t, uint8_t);
+typedef void (*bdpcm_kernel)(const uint8_t*, int16_t*, size_t, const uint16_t*);
+
+// Select the best kernels for this processor, once
+static convert_kernel select_kernel()
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return convert_avx2;
+	if (__builtin_cpu_supports("sse2")) return convert_sse2;
+	return nullptr;
+}
+
+static bdpcm_kernel select_bdpcm_kernel()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2") ? bdpcm_sse2 : nullptr;
+}
+
+// Kernels in use, nullptr for the plain C++ versions
+static convert_kernel simd_convert = select_kernel();
+static bdpcm_kernel simd_bdpcm = select_bdpcm_kernel();
+
+bool pcm_set_isa(PcmIsa isa)
+{
+	__builtin_cpu_init();
+	switch (isa)
+	{
+		case PCM_ISA_SCALAR:
+			simd_convert = nullptr;
+			simd_bdpcm = nullptr;
+			return true;
+
+		case PCM_ISA_SSE2:
+			if (!__builtin_cpu_supports("sse2")) return false;
+			simd_convert = convert_sse2;
+			simd_bdpcm = bdpcm_sse2;
+			return true;
+
+		// There is no AVX2 BDPCM kernel, the SSE2 one is used with AVX2
+		case PCM_ISA_AVX2:
+			if (!__builtin_cpu_supports("avx2")) return false;
+			simd_convert = convert_avx2;
+			simd_bdpcm = bdpcm_sse2;
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+static size_t convert_simd(const uint8_t *src, int16_t *dst, size_t count, uint8_t flip)
+{
+	return simd_convert ? simd_convert(src, dst, count, flip) : 0;
+}
+
+// Decode whole BDPCM blocks, returns the # of blocks done
+static size_t bdpcm_simd(const uint8_t *src, int16_t *dst, size_t nblocks, const uint16_t *pairs)
+{
+	if (!simd_bdpcm) return 0;
+	simd_bdpcm(src, dst, nblocks, pairs);
+	return nblocks;
+}
+
+#elif defined(PCM_CONVERT_NEON)
+
+// NEON is always there, it's only disabled to test the plain C++ versions
+static bool use_neon = true;
+
+bool pcm_set_isa(PcmIsa isa)
+{
+	if (isa != PCM_ISA_SCALAR && isa != PCM_ISA_NEON) return false;
+	use_neon = isa == PCM_ISA_NEON;
+	return true;
+}
+
+// 16 samples per iteration
+static size_t convert_simd(const uint8_t *src, int16_t *dst, size_t count, uint8_t flip)
+{
+	if (!use_neon) return 0;
+	const uint8x16_t sign = vdupq_n_u8(flip);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		uint8x16_t v = veorq_u8(vld1q_u8(src + i), sign);
+		vst1q_s16(dst + i, vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(v), 8)));
+		vst1q_s16(dst + i + 8, vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(v), 8)));
+	}
+	return i;
+}
+
+// See bdpcm_sse2()
+static size_t bdpcm_simd(const uint8_t *src, int16_t *dst, size_t nblocks, const uint16_t *pairs)
+{
+	if (!use_neon) return 0;
+	const uint8x16_t zero = vdupq_n_u8(0);
+	for (size_t block = 0; block < nblocks; ++block, src += 33, dst += 64)
+	{
+		uint16_t deltas[32];
+		deltas[0] = src[0] | (uint8_t(bdpcm_delta_lut[src[1] & 0xf]) << 8);
+		for (unsigned int j = 1; j < 32; ++j)
+			deltas[j] = pairs[src[j+1]];
+
+		uint8x16_t carry = zero;
+		for (unsigned int j = 0; j < 4; ++j)
+		{
+			uint8x16_t v = vld1q_u8((const uint8_t*)deltas + 16*j);
+			v = vaddq_u8(v, vextq_u8(zero, v, 15));
+			v = vaddq_u8(v, vextq_u8(zero, v, 14));
+			v = vaddq_u8(v, vextq_u8(zero, v, 12));
+			v = vaddq_u8(v, vextq_u8(zero, v, 8));
+			v = vaddq_u8(v, carry);
+			vst1q_s16(dst + 16*j, vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(v), 8)));
+			vst1q_s16(dst + 16*j + 8, vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(v), 8)));
+			carry = vdupq_n_u8(vgetq_lane_u8(v, 15));
+		}
+	}
+	return nblocks;
+}
+
+#else
+
+bool pcm_set_isa(PcmIsa isa)
+{
+	return isa == PCM_ISA_SCALAR;
+}
+
+static size_t convert_simd(const uint8_t *, int16_t *, size_t, uint8_t)
+{
+	return 0;
+}
+
+static size_t bdpcm_simd(const uint8_t *, int16_t *, size_t, const uint16_t *)
+{
+	return 0;
+}
+
+#endif
+
+void pcm_s8_to_s16(const uint8_t *src, int16_t *dst, size_t count)
+{
+	size_t done = convert_simd(src, dst, count, 0x00);
+	pcm_s8_to_s16_scalar(src + done, dst + done, count - done);
+}
+
+void pcm_u8_to_s16(const uint8_t *src, int16_t *dst, size_t count)
+{
+	size_t done = convert_simd(src, dst, count, 0x80);
+	pcm_u8_to_s16_scalar(src + done, dst + done, count - done);
+}
+
+/*
+ * A block consists of an initial signed 8 bit PCM byte
+ * followed by 63 nibbles stored in 32 bytes.
+ * The first of these bytes has a zero padded (unused) high nibble.
+ * This makes up of a total block size of 33 (0x21) bytes each.
+ *
+ * Decoding works like this:
+ * The initial byte can be directly read without decoding. Then each
+ * next sample can be decoded by putting the nibble into the delta-lookup-table
+ * and adding that value to the previously calculated sample
+ * until the end of the block is reached.
+ */
+void pcm_bdpcm_to_s16_scalar(const uint8_t *src, int16_t *dst, size_t count)
+{
+	size_t nblocks = count / 64;		// 64 samples per block
+	for (size_t block = 0; block < nblocks; ++block, src += 33, dst += 64)
+	{
+		int8_t sample = src[0];
+		dst[0] = uint16_t(uint8_t(sample) << 8);
+		sample += bdpcm_delta_lut[src[1] & 0xf];
+		dst[1] = uint16_t(uint8_t(sample) << 8);
+		for (unsigned int j = 1; j < 32; ++j)
+		{
+			uint8_t d = src[j+1];
+			sample += bdpcm_delta_lut[d >> 4];
+			dst[2*j] = uint16_t(uint8_t(sample) << 8);
+			sample += bdpcm_delta_lut[d & 0xf];
+			dst[2*j+1] = uint16_t(uint8_t(sample) << 8);
+		}
+	}
+	// Remaining samples are always 0
+	memset(dst, 0, 2 * (count - 64 * nblocks));
+}
+
+// Samples are the running sum of the deltas of a block (wrapping around like the GBA does),
+// the first delta being the initial sample itself
+void pcm_bdpcm_to_s16(const uint8_t *src, int16_t *dst, size_t count)
+{
+	static const BdpcmPairTable table;
+
+	size_t nblocks = count / 64;
+	size_t done = bdpcm_simd(src, dst, nblocks, table.pairs);
+	pcm_bdpcm_to_s16_scalar(src + 33 * done, dst + 64 * done, count - 64 * done);
+}
@@ -0,0 +1,40 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Conversion of 8-bit PCM and BDPCM samples to the 16-bit little endian samples of SF2 files.
+ * SIMD versions (SSE2, AVX2 or NEON) are selected at runtime when the processor
+ * supports them, and give the exact same results as the plain C++ versions.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Signed 8-bit to signed 16-bit: dst[i] = src[i] << 8
+void pcm_s8_to_s16(const uint8_t *src, int16_t *dst, size_t count);
+// Unsigned 8-bit to signed 16-bit: dst[i] = (src[i] - 0x80) << 8
+void pcm_u8_to_s16(const uint8_t *src, int16_t *dst, size_t count);
+// BDPCM compressed samples to signed 16-bit, count is the # of output samples.
+// Source is made of 33-byte blocks of 64 samples, samples after the last whole block are 0.
+void pcm_bdpcm_to_s16(const uint8_t *src, int16_t *dst, size_t count);
+
+// Plain C++ versions, always available
+void pcm_s8_to_s16_scalar(const uint8_t *src, int16_t *dst, size_t count);
+void pcm_u8_to_s16_scalar(const uint8_t *src, int16_t *dst, size_t count);
+void pcm_bdpcm_to_s16_scalar(const uint8_t *src, int16_t *dst, size_t count);
+
+// Instruction sets the conversions can use
+enum PcmIsa
+{
+	PCM_ISA_SCALAR,		// Plain C++ versions only
+	PCM_ISA_SSE2,
+	PCM_ISA_AVX2,
+	PCM_ISA_NEON
+};
+
+// Force the conversions to use an instruction set instead of the best one the processor has,
+// so that every kernel can be checked (see pcm_convert_test.cpp).
+// Returns false if the processor or this build doesn't have it. Not thread safe.
+bool pcm_set_isa(PcmIsa isa);
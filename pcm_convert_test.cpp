@@ -0,0 +1,132 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Self-check of the PCM conversion kernels: every instruction set the processor has
+ * is forced in turn, and its output is compared to the plain C++ versions.
+ * Run by "make check", exits with 1 if any output differs.
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "pcm_convert.hpp"
+
+typedef void (*convert_func)(const uint8_t*, int16_t*, size_t);
+
+static const size_t large_count = 100003;	// Odd, so that every kernel has a tail left
+static const int guard = 8;					// Output samples checked to be untouched after the end
+static const int16_t guard_value = 0x5a5a;
+
+static uint32_t rng_state = 2463534242u;
+
+// Xorshift, so that the random data is the same on every run
+static uint32_t rng()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static int failures = 0;
+
+// Convert count samples from src at src_shift and to dst_shift samples after the start of the output,
+// with both functions, and compare
+static void check(const char *name, convert_func func, convert_func scalar,
+                  const uint8_t *src, size_t count, int src_shift, int dst_shift)
+{
+	std::vector<int16_t> expected(count + guard + 16, guard_value);
+	std::vector<int16_t> result(count + guard + 16, guard_value);
+	scalar(src + src_shift, &expected[dst_shift], count);
+	func(src + src_shift, &result[dst_shift], count);
+
+	if (result != expected)
+	{
+		size_t i = 0;
+		while (result[i] == expected[i]) i++;
+		printf("FAIL %s: %u samples, source + %d, output + %d: sample %d is 0x%04x instead of 0x%04x\n",
+		       name, unsigned(count), src_shift, dst_shift, int(i) - dst_shift, uint16_t(result[i]), uint16_t(expected[i]));
+		failures++;
+	}
+}
+
+static void check_convert(const char *name, convert_func func, convert_func scalar)
+{
+	// Every byte value, from every source and output alignment
+	std::vector<uint8_t> src(large_count + 64);
+	for (size_t i = 0; i < src.size(); i++)
+		src[i] = uint8_t(i);
+	for (int s = 0; s < 16; s++)
+		for (int d = 0; d < 8; d++)
+			check(name, func, scalar, &src[0], 256, s, d);
+
+	// Every length up to 64, so every tail length of every kernel
+	for (size_t i = 0; i < src.size(); i++)
+		src[i] = uint8_t(rng());
+	for (size_t count = 0; count <= 64; count++)
+		for (int s = 0; s < 4; s++)
+			for (int d = 0; d < 4; d++)
+				check(name, func, scalar, &src[0], count, s, d);
+
+	for (int s = 0; s < 4; s++)
+		check(name, func, scalar, &src[0], large_count, s, 3 - s);
+}
+
+static void check_bdpcm(const char *name)
+{
+	// Random blocks wrap around the 8-bit samples often
+	const size_t max_blocks = 40;
+	std::vector<uint8_t> src(33 * max_blocks + 16);
+	for (size_t i = 0; i < src.size(); i++)
+		src[i] = uint8_t(rng());
+
+	// Blocks of only the largest deltas in the same direction, to check the running sum of each
+	// group of samples a kernel handles at once is carried over to the next group
+	for (int b = 0; b < 4; b++)
+	{
+		src[33 * b] = uint8_t(0x80 + b);
+		memset(&src[33 * b + 1], b & 1 ? 0x88 : 0x77, 32);
+	}
+
+	// Partial blocks at the end are zeros
+	for (size_t count = 0; count <= 64 * 5 + 63; count += 7)
+		for (int s = 0; s < 4; s++)
+			for (int d = 0; d < 4; d++)
+				check(name, pcm_bdpcm_to_s16, pcm_bdpcm_to_s16_scalar, &src[0], count, s, d);
+
+	for (int s = 0; s < 16; s++)
+		check(name, pcm_bdpcm_to_s16, pcm_bdpcm_to_s16_scalar, &src[0], 64 * max_blocks, s, s & 7);
+	check(name, pcm_bdpcm_to_s16, pcm_bdpcm_to_s16_scalar, &src[0], 64 * max_blocks - 1, 0, 0);
+}
+
+int main()
+{
+	static const struct
+	{
+		PcmIsa isa;
+		const char *name;
+	} isas[] =
+	{
+		{PCM_ISA_SCALAR, "scalar"},
+		{PCM_ISA_SSE2, "SSE2"},
+		{PCM_ISA_AVX2, "AVX2"},
+		{PCM_ISA_NEON, "NEON"}
+	};
+
+	for (unsigned int i = 0; i < sizeof(isas) / sizeof(isas[0]); i++)
+	{
+		if (!pcm_set_isa(isas[i].isa))
+		{
+			printf("%s: skipped, not available\n", isas[i].name);
+			continue;
+		}
+		int before = failures;
+		check_convert("s8", pcm_s8_to_s16, pcm_s8_to_s16_scalar);
+		check_convert("u8", pcm_u8_to_s16, pcm_u8_to_s16_scalar);
+		check_bdpcm("BDPCM");
+		printf("%s: %s\n", isas[i].name, failures == before ? "OK" : "FAILED");
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Reverse pointer index of a GBA ROM: for any ROM offset, the word aligned locations
+ * of the ROM which contain a pointer to it.
+ *
+ * The index is built in two passes over the ROM: the first one counts the pointers to
+ * every 256-byte bucket of targets, the second one stores them in their bucket, and each
+ * bucket is then sorted by target. Lookups are a binary search within a single bucket.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class PointerIndex
+{
+public:
+	struct Ref
+	{
+		uint32_t target;		// ROM offset which is pointed to
+		uint32_t source;		// ROM offset of the word which points to target
+
+		bool operator <(const Ref& r) const
+		{
+			return target != r.target ? target < r.target : source < r.source;
+		}
+	};
+
+private:
+	static const int bucket_shift = 8;
+
+	std::vector<Ref> refs;				// All pointers, sorted by target then by source
+	std::vector<uint32_t> buckets;		// Index of the first pointer of each bucket in refs, and the end of refs
+
+	// ROM offset a word points to, -1 if it doesn't point within the ROM
+	static int64_t pointed(const uint8_t *word, size_t size)
+	{
+		uint32_t address = word[0] | (word[1] << 8) | (word[2] << 16) | ((uint32_t)word[3] << 24);
+		if (((address >> 24) & 0xfe) != 0x08) return -1;
+		address &= 0x1ffffff;
+		return address < size ? int64_t(address) : -1;
+	}
+
+public:
+	PointerIndex(const uint8_t *rom, size_t size) : buckets((size >> bucket_shift) + 2, 0)
+	{
+		// Count pointers per bucket, then turn the counts into the start of each bucket
+		for (size_t offset = 0; offset + 4 <= size; offset += 4)
+		{
+			int64_t target = pointed(rom + offset, size);
+			if (target >= 0) buckets[(target >> bucket_shift) + 1]++;
+		}
+		for (size_t b = 1; b < buckets.size(); b++)
+			buckets[b] += buckets[b - 1];
+
+		refs.resize(buckets.back());
+		std::vector<uint32_t> fill(buckets.begin(), buckets.end() - 1);
+		for (size_t offset = 0; offset + 4 <= size; offset += 4)
+		{
+			int64_t target = pointed(rom + offset, size);
+			if (target < 0) continue;
+			Ref& ref = refs[fill[target >> bucket_shift]++];
+			ref.target = uint32_t(target);
+			ref.source = uint32_t(offset);
+		}
+
+		for (size_t b = 0; b + 1 < buckets.size(); b++)
+			std::sort(refs.begin() + buckets[b], refs.begin() + buckets[b + 1]);
+	}
+
+	// All pointers of the ROM, sorted by target then by source
+	const std::vector<Ref>& all() const
+	{
+		return refs;
+	}
+
+	// Words pointing to the given ROM offset, as a range of all() sorted by source
+	std::pair<const Ref *, const Ref *> find(uint32_t target) const
+	{
+		size_t bucket = target >> bucket_shift;
+		if (bucket + 1 >= buckets.size()) return std::make_pair(nullptr, nullptr);
+
+		const Ref *first = refs.data() + buckets[bucket], *last = refs.data() + buckets[bucket + 1];
+		Ref lo = {target, 0}, hi = {target, 0xffffffff};
+		return std::make_pair(std::lower_bound(first, last, lo), std::upper_bound(first, last, hi));
+	}
+};
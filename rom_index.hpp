@@ -0,0 +1,117 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Analysis of a ROM by gba_mus_ripper (song table, songs and their sound banks),
+ * which is saved next to the ripped files so that ripping the same ROM again,
+ * even with different conversion flags, doesn't redo the analysis.
+ *
+ * The file is a small binary file in little endian, and is only used if the hash
+ * of the ROM, the flags which change the analysis and the known game entry it was
+ * made from match the current ones.
+ *
+ * The banks' instruments and samples aren't saved: sound_font_ripper reads them
+ * from the ROM once per run in its bank graph, which takes little time next to
+ * the conversion, and this file is read once with a few freads, as it's only a few
+ * KB long, memory-mapping it wouldn't save anything.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define ROM_INDEX_MAGIC 0x49524d47		// "GMRI"
+#define ROM_INDEX_VERSION 2
+#define ROM_INDEX_NO_BANK 0xffffffff
+
+struct RomIndex
+{
+	uint64_t rom_hash;				// Hash of the whole ROM
+	uint32_t flags;					// Analysis flags the index was made with
+	uint32_t manual_tbl_ptr;		// Song table address given by the user, 0 if none
+	uint32_t game_hash;				// Hash of the known game entry the song table comes from
+	uint32_t song_tbl_ptr;
+	int32_t sample_rate, main_volume;
+	std::vector<uint32_t> songs;		// Song headers
+	std::vector<uint32_t> song_banks;	// Index of each song's sound bank, ROM_INDEX_NO_BANK if none
+	std::vector<uint32_t> banks;		// Sound banks, in increasing order
+};
+
+// 64-bit FNV-1a hash
+static uint64_t rom_index_hash(const uint8_t *data, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static bool write_u32_list(FILE *f, const std::vector<uint32_t>& list)
+{
+	uint32_t size = list.size();
+	return fwrite(&size, 4, 1, f) == 1 && fwrite(list.data(), 4, size, f) == size;
+}
+
+static bool read_u32_list(FILE *f, std::vector<uint32_t>& list)
+{
+	uint32_t size;
+	if (fread(&size, 4, 1, f) != 1 || size > 0x1000000) return false;
+	list.resize(size);
+	return fread(list.data(), 4, size, f) == size;
+}
+
+// Save the analysis of a ROM, returns false if the file can't be written
+static bool save_rom_index(const std::string& filename, const RomIndex& index)
+{
+	FILE *f = fopen(filename.c_str(), "wb");
+	if (!f) return false;
+
+	uint32_t header[8] =
+	{
+		ROM_INDEX_MAGIC, ROM_INDEX_VERSION, (uint32_t)index.rom_hash, (uint32_t)(index.rom_hash >> 32),
+		index.flags, index.manual_tbl_ptr, index.song_tbl_ptr, index.game_hash
+	};
+	int32_t params[2] = {index.sample_rate, index.main_volume};
+	bool ok = fwrite(header, 4, 8, f) == 8 && fwrite(params, 4, 2, f) == 2
+		&& write_u32_list(f, index.songs) && write_u32_list(f, index.song_banks) && write_u32_list(f, index.banks);
+	ok = !fclose(f) && ok;
+	if (!ok) remove(filename.c_str());
+	return ok;
+}
+
+// Load the analysis of a ROM, only if it has been made for the same ROM, analysis flags
+// and known game as the given index. Returns false if it hasn't or if the file can't be read.
+static bool load_rom_index(const std::string& filename, RomIndex& index)
+{
+	FILE *f = fopen(filename.c_str(), "rb");
+	if (!f) return false;
+
+	uint32_t header[8];
+	int32_t params[2];
+	RomIndex loaded;
+	bool ok = fread(header, 4, 8, f) == 8 && fread(params, 4, 2, f) == 2
+		&& header[0] == ROM_INDEX_MAGIC && header[1] == ROM_INDEX_VERSION
+		&& header[2] == (uint32_t)index.rom_hash && header[3] == (uint32_t)(index.rom_hash >> 32)
+		&& header[4] == index.flags && header[5] == index.manual_tbl_ptr && header[7] == index.game_hash
+		&& read_u32_list(f, loaded.songs) && read_u32_list(f, loaded.song_banks) && read_u32_list(f, loaded.banks)
+		&& loaded.songs.size() == loaded.song_banks.size();
+	fclose(f);
+
+	for (size_t i = 0; ok && i < loaded.song_banks.size(); i++)
+		ok = loaded.song_banks[i] == ROM_INDEX_NO_BANK || loaded.song_banks[i] < loaded.banks.size();
+	if (!ok) return false;
+
+	index.song_tbl_ptr = header[6];
+	index.sample_rate = params[0];
+	index.main_volume = params[1];
+	index.songs.swap(loaded.songs);
+	index.song_banks.swap(loaded.song_banks);
+	index.banks.swap(loaded.banks);
+	return true;
+}
@@ -0,0 +1,51 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Detection of the Sappy sound engine within a GBA ROM, shared by sappy_detector and
+ * gba_mus_ripper. It's plain C99 so that both C and C++ programs can link with it.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+	unsigned int polyphony           : 4;
+	unsigned int main_vol            : 4;
+	unsigned int sampling_rate_index : 4;
+	unsigned int dac_bits            : 4;
+}
+sound_engine_param_t;
+
+// Everything the detector knows about the engine of a ROM
+typedef struct
+{
+	long main_offset;					// Offset of the m4a main function, -1 if no engine was found
+	long selectsong_offset;				// Offset of the m4a selectsong function
+	bool partial;						// The engine was found, but not its parameters
+	uint32_t offset;					// Offset of the engine parameters
+	uint32_t song_levels;
+	uint32_t song_table;				// Offset of the song table
+	sound_engine_param_t params;
+	unsigned int songs;					// # of entries in the song table
+	double confidence;					// 0.0 (nothing found) to 1.0 (everything is consistent)
+}
+sappy_engine_t;
+
+// Detect the sound engine within a ROM loaded in memory. Returns true if a full engine was found.
+bool sappy_detect(const uint8_t *rom, size_t size, sappy_engine_t *engine);
+
+// Print what was detected in a human readable form
+void print_engine(const sappy_engine_t *engine);
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,20 +6,33 @@
  * If an engine is present it returns a pointer to the instrument list.
  * If no engine is present, it returns the value 0
  * It's not 100% accurate, so sometimes it might produce erroneous results
+ *
+ * In batch mode, a whole collection of ROMs is scanned concurrently and a report
+ * is printed for each of them as a line of JSON.
  */
 
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <memory.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "sappy_detect.h"
 
 typedef const char *const string;
 
-string sr_lookup[16] =
+static const int sample_rates[16] =
 {
-	"invalid", "5734 Hz", "7884 Hz", "10512 Hz", "13379 Hz", "15768 Hz", "18157 Hz",
-	"21024 Hz", "26758 Hz", "31536 Hz", "36314 Hz", "40137 Hz", "42048 Hz", "invalid", "invalid", "invalid"
+	0, 5734, 7884, 10512, 13379, 15768, 18157, 21024, 26758, 31536, 36314, 40137, 42048, 0, 0, 0
 };
 
 static void print_instructions()
@@ -28,324 +41,292 @@ static void print_instructions()
 	(
 	   "GBA Sappy Engine Detector (c) 2015 by Bregalad and loveemu\n"
 	   "Usage: sappy_detector game.gba\n"
+	   "       sappy_detector -b [-jN] path1 [path2] ...\n\n"
+	   "-b  : Batch mode. Every path is either a ROM, a directory which is searched for .gba files\n"
+	   "      or @list.txt, a text file with one ROM path per line. Every ROM gets a line of JSON on stdout.\n"
+	   "-jN : Scan N ROMs at a time in batch mode. Default: # of processors\n"
 	);
 	exit(0);
 }
 
-static uint8_t m4a_bin_selectsong[0x1E] =
-{
-	0x00, 0xB5, 0x00, 0x04, 0x07, 0x4A, 0x08, 0x49,
-	0x40, 0x0B, 0x40, 0x18, 0x83, 0x88, 0x59, 0x00,
-	0xC9, 0x18, 0x89, 0x00, 0x89, 0x18, 0x0A, 0x68,
-	0x01, 0x68, 0x10, 0x1C, 0x00, 0xF0,
-};
-
-// we need to check 2 tables because the m4a library was recompiled for some games.
-static uint8_t m4a_bin_selectsong_new[0x1E] =
-{
-	0x00, 0xB5, 0x00, 0x04, 0x07, 0x4B, 0x08, 0x49,
-	0x40, 0x0B, 0x40, 0x18, 0x82, 0x88, 0x51, 0x00,
-	0x89, 0x18, 0x89, 0x00, 0xC9, 0x18, 0x0A, 0x68,
-	0x01, 0x68, 0x10, 0x1C, 0x00, 0xF0,
-};
-
-#define M4A_MAIN_PATT_COUNT 1
-#define M4A_MAIN_LEN 2
-static uint8_t m4a_bin_main[M4A_MAIN_PATT_COUNT][M4A_MAIN_LEN] =
-{
-	{0x00, 0xB5}
-};
-
-#define M4A_INIT_PATT_COUNT 2
-#define M4A_INIT_LEN 2
-
-// byte reader/writer (little-endian)
-static inline uint32_t read_u32 (uint8_t *data) { return data[0] + (data[1] << 8) + (data[2] << 16) + (data[3] << 24); }
-
-static long memsearch(uint8_t *dst, size_t dstsize, uint8_t *src, size_t srcsize, size_t dst_offset, size_t alignment, int diff_threshold)
+// Load a whole ROM in memory, returns NULL (and an error message) if it can't be done
+static uint8_t *read_rom(const char *path, size_t *size, const char **error)
 {
-	if (alignment == 0)
+	FILE *inGBA = fopen(path, "rb");
+	if (!inGBA)
 	{
-		return -1;
+		*error = "File can't be opened for reading";
+		return NULL;
 	}
 
-	// alignment
-	if (dst_offset % alignment != 0)
+	/* Get the size of the input GBA file */
+	fseek(inGBA, 0L, SEEK_END);
+	*size = ftell(inGBA);
+
+	uint8_t *rom = (uint8_t*)malloc(*size ? *size : 1);
+	if (!rom)
 	{
-		dst_offset += alignment - (dst_offset % alignment);
+		*error = "Can't allocate memory for ROM dump";
+		fclose(inGBA);
+		return NULL;
 	}
 
-	for (size_t offset = dst_offset; (offset + srcsize) <= dstsize; offset += alignment)
+	fseek(inGBA, 0L, SEEK_SET);
+	if (fread(rom, 1, *size, inGBA) != *size)
 	{
-		// memcmp(&dst[offset], src, srcsize)
-		int diff = 0;
-		for (size_t i = 0; i < srcsize; i++)
-		{
-			if (dst[offset + i] != src[i])
-			{
-				diff++;
-			}
-			if (diff > diff_threshold)
-			{
-				break;
-			}
-		}
-		if (diff <= diff_threshold)
-		{
-			return offset;
-		}
+		*error = "Can't dump ROM file";
+		free(rom);
+		rom = NULL;
 	}
-	return -1;
+	fclose(inGBA);
+	return rom;
 }
 
-static bool is_valid_offset(uint32_t offset, uint32_t romsize)
-{
-	return (offset < romsize);
-}
+/*
+ * Batch mode
+ */
 
-static bool is_gba_rom_address(uint32_t address)
+typedef struct
 {
-	uint8_t region = (address >> 24) & 0xFE;
-	return (region == 8 || region == 9);
+	char **paths;
+	size_t count;
+	size_t capacity;
+	size_t next;						// Next ROM to be scanned by a worker
+	pthread_mutex_t lock;				// Protects "next" and the output
 }
+rom_list_t;
 
-static uint32_t gba_address_to_offset(uint32_t address)
+static void rom_list_add(rom_list_t *list, const char *path)
 {
-	if (!is_gba_rom_address(address))
+	if (list->count == list->capacity)
 	{
-		fprintf(stderr, "Warning: the address $%08X is not a valid ROM address.\n", address);
+		list->capacity = list->capacity ? 2 * list->capacity : 256;
+		list->paths = (char**)realloc(list->paths, list->capacity * sizeof(char*));
+		if (!list->paths)
+		{
+			fputs("Error: Can't allocate memory for ROM list.\n", stderr);
+			exit(-1);
+		}
 	}
-	return address & 0x01FFFFFF;
+	size_t len = strlen(path);
+	list->paths[list->count] = (char*)malloc(len + 1);
+	memcpy(list->paths[list->count++], path, len + 1);
 }
 
-/* Thanks to loveeemu for this routine, more accurate than mine ! Slightly adapted. */
-#define M4A_OFFSET_SONGTABLE 40
-static long m4a_searchblock(uint8_t *gbarom, size_t gbasize)
+static bool has_gba_extension(const char *name)
 {
-	long m4a_selectsong_offset = -1;
-	long m4a_main_offset = -1;
+	size_t len = strlen(name);
+	if (len < 4) return false;
+	const char *ext = name + len - 4;
+	return ext[0] == '.' && (ext[1] | 0x20) == 'g' && (ext[2] | 0x20) == 'b' && (ext[3] | 0x20) == 'a';
+}
 
-	long m4a_selectsong_search_offset = 0;
-	while (m4a_selectsong_search_offset != -1)
+// Add all .gba files in a directory and its sub-directories
+// Symbolic links to directories aren't followed, so links looping back to a parent can't recurse forever
+static void rom_list_add_directory(rom_list_t *list, const char *dirname)
+{
+	DIR *dir = opendir(dirname);
+	if (!dir)
+	{
+		fprintf(stderr, "Error: Directory %s can't be opened.\n", dirname);
+		return;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dir)))
 	{
-		m4a_selectsong_offset = memsearch(gbarom, gbasize, m4a_bin_selectsong, sizeof(m4a_bin_selectsong), m4a_selectsong_search_offset, 1, 0);
+		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
 
-		if (m4a_selectsong_offset == -1)
-		{
-			// we didn't find the first library, so attempt to find the newer m4a library.
-			m4a_selectsong_offset = memsearch(gbarom, gbasize, m4a_bin_selectsong_new, sizeof(m4a_bin_selectsong_new), m4a_selectsong_search_offset, 1, 0);
-		}
+		size_t len = strlen(dirname) + strlen(entry->d_name) + 2;
+		char *path = (char*)malloc(len);
+		snprintf(path, len, "%s/%s", dirname, entry->d_name);
 
-		if (m4a_selectsong_offset != -1)
+		struct stat st;
+		if (!lstat(path, &st))
 		{
-#ifdef _DEBUG
-			fprintf(stdout, "Selectsong candidate: $%08X\n", m4a_selectsong_offset);
-#endif
-
-			// obtain song table address
-			uint32_t m4a_songtable_address = read_u32(&gbarom[m4a_selectsong_offset + M4A_OFFSET_SONGTABLE]);
-			if (!is_gba_rom_address(m4a_songtable_address))
-			{
-#ifdef _DEBUG
-				fprintf(stdout, "Song table address error: not a ROM address $%08X\n", m4a_songtable_address);
-#endif
-				m4a_selectsong_search_offset = m4a_selectsong_offset + 1;
-				continue;
-			}
-			uint32_t m4a_songtable_offset_tmp = gba_address_to_offset(m4a_songtable_address);
-			if (!is_valid_offset(m4a_songtable_offset_tmp + 4 - 1, gbasize))
-			{
-#ifdef _DEBUG
-				fprintf(stdout, "Song table address error: address out of range $%08X\n", m4a_songtable_address);
-#endif
-				m4a_selectsong_search_offset = m4a_selectsong_offset + 1;
-				continue;
-			}
+			// Links to ROM files are still scanned
+			bool link = S_ISLNK(st.st_mode);
+			if (link && stat(path, &st)) st.st_mode = 0;
 
-			// song table must have more than one song
-			int validsongcount = 0;
-			for (int songindex = 0; validsongcount < 1; songindex++)
-			{
-				uint32_t songaddroffset = m4a_songtable_offset_tmp + (songindex * 8);
-				if (!is_valid_offset(songaddroffset + 4 - 1, gbasize))
-				{
-					break;
-				}
-
-				uint32_t songaddr = read_u32(&gbarom[songaddroffset]);
-				if (songaddr == 0)
-				{
-					continue;
-				}
-
-				if (!is_gba_rom_address(songaddr))
-				{
-#ifdef _DEBUG
-					fprintf(stdout, "Song address error: not a ROM address $%08X\n", songaddr);
-#endif
-					break;
-				}
-				if (!is_valid_offset(gba_address_to_offset(songaddr) + 4 - 1, gbasize))
-				{
-#ifdef _DEBUG
-					fprintf(stdout, "Song address error: address out of range $%08X\n", songaddr);
-#endif
-					break;
-				}
-				validsongcount++;
-			}
-			if (validsongcount < 1)
+			if (S_ISDIR(st.st_mode))
 			{
-				m4a_selectsong_search_offset = m4a_selectsong_offset + 1;
-				continue;
+				if (!link) rom_list_add_directory(list, path);
 			}
-			break;
-		}
-		else
-		{
-			m4a_selectsong_search_offset = -1;
+			else if (S_ISREG(st.st_mode) && has_gba_extension(entry->d_name))
+				rom_list_add(list, path);
 		}
+		free(path);
 	}
-	if (m4a_selectsong_offset == -1)
-	{
-		return -1;
-	}
+	closedir(dir);
+}
 
-	uint32_t m4a_main_offset_tmp = m4a_selectsong_offset;
-	if (!is_valid_offset(m4a_main_offset_tmp + M4A_MAIN_LEN - 1, gbasize))
+// Add the ROMs of a text file containing a path per line
+static void rom_list_add_file_list(rom_list_t *list, const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f)
 	{
-		return -1;
+		fprintf(stderr, "Error: File list %s can't be opened.\n", filename);
+		return;
 	}
-	while (m4a_main_offset_tmp > 0 && m4a_main_offset_tmp > ((uint32_t) m4a_selectsong_offset - 0x20))
+	char line[4096];
+	while (fgets(line, sizeof(line), f))
 	{
-		for (int mainpattern = 0; mainpattern < M4A_MAIN_PATT_COUNT; mainpattern++)
-		{
-			if (memcmp(&gbarom[m4a_main_offset_tmp], &m4a_bin_main[mainpattern][0], M4A_INIT_LEN) == 0)
-			{
-				m4a_main_offset = (long) m4a_main_offset_tmp;
-				break;
-			}
-		}
-		m4a_main_offset_tmp--;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0]) rom_list_add(list, line);
 	}
-	return m4a_main_offset;
+	fclose(f);
 }
 
-typedef struct
-{
-	unsigned int polyphony           : 4;
-	unsigned int main_vol            : 4;
-	unsigned int sampling_rate_index : 4;
-	unsigned int dac_bits            : 4;
-}
-sound_engine_param_t;
-
-static sound_engine_param_t sound_engine_param(uint32_t data)
+// Print a string with JSON escapes
+static void json_string(FILE *out, const char *s)
 {
-	sound_engine_param_t s;
-	s.polyphony = (data & 0x000F00) >> 8;
-	s.main_vol = (data & 0x00F000) >> 12;
-	s.sampling_rate_index = (data & 0x0F0000) >> 16;
-	s.dac_bits = 17-((data & 0xF00000) >> 20);
-	return s;
+	fputc('"', out);
+	for (; *s; s++)
+	{
+		unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
 }
 
-// Test if an area of ROM is eligible to be the base pointer
-static bool test_pointer_validity(uint32_t *data, uint32_t inGBA_length)
+static double elapsed_ms(const struct timespec *start)
 {
-	sound_engine_param_t params = sound_engine_param(data[0]);
-
-	/* Compute (supposed ?) address of song table */
-	uint32_t song_tbl_adr = (data[2] & 0x3FFFFFF) + 12 * data[1];
-
-	/* Prevent illegal values for all fields */
-	return  params.main_vol != 0
-	     && params.polyphony <= 12
-	     && params.dac_bits >= 6
-		 && params.dac_bits <= 9
-	     && params.sampling_rate_index >= 1
-	     && params.sampling_rate_index <= 12
-	     && song_tbl_adr < inGBA_length
-	     && data[1] < 256
-	     &&((data[0] & 0xff000000) == 0);
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_nsec - start->tv_nsec) / 1000000.0;
 }
 
-int main(const int argc, string argv[])
+static void print_json_report(const char *path, const sappy_engine_t *engine, const char *error, double time_ms)
 {
-	if (argc != 2) print_instructions();
-	puts("Sappy sound engine detector (c) 2015 by Bregalad and loveemu\n");
-
-	FILE *inGBA = fopen(argv[1], "rb");
-	if (!inGBA)
+	fputs("{\"file\": ", stdout);
+	json_string(stdout, path);
+	if (error)
 	{
-		fprintf(stderr, "Error: File %s can't be opened for reading.\n", argv[1]);
-		exit(0);
+		fputs(", \"error\": ", stdout);
+		json_string(stdout, error);
 	}
-
-	/* Get the size of the input GBA file */
-	fseek(inGBA, 0L, SEEK_END);
-	const size_t inGBA_length = ftell(inGBA);
-
-	uint8_t *inGBA_dump = (uint8_t*)malloc(inGBA_length);
-	if (!inGBA_dump)
+	else
 	{
-		fprintf(stderr, "Error: Can't allocate memory for ROM dump.\n");
-		exit(0);
+		printf(", \"engine\": %s, \"partial\": %s", engine->main_offset >= 0 && !engine->partial ? "true" : "false",
+			engine->partial ? "true" : "false");
+		if (engine->main_offset >= 0)
+			printf(", \"main_offset\": %ld", engine->main_offset);
+		if (engine->main_offset >= 0 && !engine->partial)
+		{
+			printf
+			(
+				", \"engine_offset\": %u, \"song_table\": %u, \"song_levels\": %u, \"songs\": %u"
+				", \"main_volume\": %u, \"polyphony\": %u, \"dac_bits\": %u, \"sampling_rate\": %d",
+				engine->offset, engine->song_table, engine->song_levels, engine->songs,
+				engine->params.main_vol, engine->params.polyphony, 17-engine->params.dac_bits,
+				sample_rates[engine->params.sampling_rate_index]
+			);
+		}
+		printf(", \"confidence\": %.2f", engine->confidence);
 	}
+	printf(", \"time_ms\": %.3f}\n", time_ms);
+}
 
-	fseek(inGBA, 0L, SEEK_SET);
-	size_t errcode = fread(inGBA_dump, 1, inGBA_length, inGBA);
-	if (errcode != inGBA_length)
+static void *batch_worker(void *arg)
+{
+	rom_list_t *list = (rom_list_t*)arg;
+	while (true)
 	{
-		fprintf(stderr, "Error: Can't dump ROM file. %lu\n", errcode);
-		exit(0);
+		pthread_mutex_lock(&list->lock);
+		size_t i = list->next++;
+		pthread_mutex_unlock(&list->lock);
+		if (i >= list->count) break;
+
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		sappy_engine_t engine;
+		const char *error = NULL;
+		size_t size;
+		uint8_t *rom = read_rom(list->paths[i], &size, &error);
+		if (rom)
+		{
+			sappy_detect(rom, size, &engine);
+			free(rom);
+		}
+		double time_ms = elapsed_ms(&start);
+
+		// Reports are printed whole so lines of concurrent workers never mix
+		pthread_mutex_lock(&list->lock);
+		print_json_report(list->paths[i], &engine, error, time_ms);
+		pthread_mutex_unlock(&list->lock);
 	}
-	fclose(inGBA);
+	return NULL;
+}
 
-	int32_t offset = m4a_searchblock(inGBA_dump, inGBA_length);
+static int batch_main(const int argc, string argv[])
+{
+	rom_list_t list;
+	memset(&list, 0, sizeof(list));
+	pthread_mutex_init(&list.lock, NULL);
 
-	if (offset < 0)
+	int nthreads = 0;
+	for (int i = 2; i < argc; i++)
 	{
-		/* If no address were told manually and nothing was detected.... */
-		puts("No sound engine was found.");
-		exit(0);
+		if (argv[i][0] == '-' && argv[i][1] == 'j')
+			nthreads = atoi(argv[i] + 2);
+		else if (argv[i][0] == '@')
+			rom_list_add_file_list(&list, argv[i] + 1);
+		else
+		{
+			struct stat st;
+			if (!stat(argv[i], &st) && S_ISDIR(st.st_mode))
+				rom_list_add_directory(&list, argv[i]);
+			else
+				rom_list_add(&list, argv[i]);
+		}
 	}
-	printf("Sound engine detected at offset 0x%x\n", offset);
 
-	/* Test validity of engine offset with -16 and -32 */
-	bool valid_m16 = test_pointer_validity((uint32_t*)(inGBA_dump + offset - 16), inGBA_length);	// For most games
-	bool valid_m32 = test_pointer_validity((uint32_t*)(inGBA_dump + offset - 32), inGBA_length);	// For pokémon
+#ifdef _SC_NPROCESSORS_ONLN
+	if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (nthreads <= 0) nthreads = 4;
+	if ((size_t)nthreads > list.count) nthreads = list.count;
+
+	pthread_t *threads = (pthread_t*)malloc((nthreads ? nthreads : 1) * sizeof(pthread_t));
+	for (int i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, batch_worker, &list);
+	for (int i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	for (size_t i = 0; i < list.count; i++)
+		free(list.paths[i]);
+	free(list.paths);
+	pthread_mutex_destroy(&list.lock);
+	return 0;
+}
+
+int main(const int argc, string argv[])
+{
+	if (argc >= 2 && !strcmp(argv[1], "-b")) return batch_main(argc, argv);
+	if (argc != 2) print_instructions();
+	puts("Sappy sound engine detector (c) 2015 by Bregalad and loveemu\n");
 
-	/* If neither is found there is an error */
-	if (!valid_m16 && !valid_m32)
+	const char *error;
+	size_t inGBA_length;
+	uint8_t *inGBA_dump = read_rom(argv[1], &inGBA_length, &error);
+	if (!inGBA_dump)
 	{
-		puts("Only a partial sound engine was found.");
+		fprintf(stderr, "Error: %s: %s.\n", argv[1], error);
 		exit(0);
 	}
-	offset -= valid_m16 ? 16 : 32;
-
-	uint32_t *data = (uint32_t*)(inGBA_dump + offset);
-	uint32_t song_tbl_adr = (data[2] & 0x3FFFFFF) + 12 * data[1];
-	sound_engine_param_t params = sound_engine_param(data[0]);
-
-	//Read # of song levels
-	printf("# of song levels: %d\n", data[1]);
-
-	// At this point we can be certain we detected the real thing.
-	printf
-	(
-		"Engine parameters:\n"
-		"Main Volume: %u Polyphony: %u channels, Dac: %u bits, Sampling rate: %s\n"
-		"Song table located at: 0x%x\n",
-		params.main_vol,
-		params.polyphony,
-		17-params.dac_bits,
-		sr_lookup[params.sampling_rate_index],
-		song_tbl_adr
-	);
 
+	sappy_engine_t engine;
+	bool found = sappy_detect(inGBA_dump, inGBA_length, &engine);
 	free(inGBA_dump);
+	print_engine(&engine);
 
 	/* Return the offset of sappy info to the operating system */
-	return offset;
+	return found ? engine.offset : 0;
 }
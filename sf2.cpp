@@ -25,6 +25,7 @@
 
 #include <cstdio>
 #include <cstring>
+#include <vector>
 #include "sf2.hpp"
 #include "sf2_chunks.hpp"
 #include "gba_samples.hpp"
@@ -35,7 +36,10 @@ SF2::SF2(unsigned int sample_rate) :
 	infolist_chunk(new InfoListChunk(this)),
 	sdtalist_chunk(new SdtaListChunk(this)),
 	pdtalist_chunk(new HydraChunk(this)),
-	default_sample_rate(sample_rate)
+	stream_pos(-1),
+	default_sample_rate(sample_rate),
+	pcm_cache(nullptr),
+	threads(0)
 {}
 
 SF2::~SF2()
@@ -45,11 +49,40 @@ SF2::~SF2()
 	delete pdtalist_chunk;
 }
 
+//Start writing to the target file before all data is known
+//Samples are written as soon as they are added, and the rest of the file when write() is called,
+//so this should be called before any sample is added.
+void SF2::stream(FILE *outfile)
+{
+	out = outfile;
+	out_buffer.resize(1 << 20);
+	setvbuf(out, out_buffer.data(), _IOFBF, out_buffer.size());
+
+	//Write RIFF header, its size is only known at the end
+	fwrite("RIFF", 1, 4, out);
+	fwrite(&size, 4, 1, out);
+	fwrite("sfbk", 1, 4, out);
+
+	infolist_chunk->calcSize();
+	infolist_chunk->write();
+
+	stream_pos = ftell(out);
+	sdtalist_chunk->start_stream();
+}
+
 //Write data to the target file
 //(should only be called once !)
 void SF2::write(FILE *outfile)
 {
-	out = outfile;
+	if (stream_pos < 0)
+	{
+		out = outfile;
+		// Samples are written in many small pieces, a large buffer makes the whole file
+		// go out in a handful of write calls
+		out_buffer.resize(1 << 20);
+		setvbuf(out, out_buffer.data(), _IOFBF, out_buffer.size());
+	}
+
 	// This function adds the "terminal" data in subchunks that are required
 	// by the (retarded) SF2 standard
 	add_terminals();
@@ -61,15 +94,30 @@ void SF2::write(FILE *outfile)
 	size += sdtalist_chunk->calcSize() + 8;
 	size += pdtalist_chunk->calcSize() + 8;
 
-	//Write RIFF header
-	fwrite("RIFF", 1, 4, out);
-	fwrite(&size, 4, 1, out);
-	fwrite("sfbk", 1, 4, out);
+	if (stream_pos >= 0)
+	{
+		//Samples are already written, add the hydra chunk after them
+		//then go back to write the sizes which weren't known
+		pdtalist_chunk->write();
 
-	//Write all 3 chunks
-	infolist_chunk->write();
-	sdtalist_chunk->write();
-	pdtalist_chunk->write();
+		fseek(out, 4, SEEK_SET);
+		fwrite(&size, 4, 1, out);
+		fseek(out, stream_pos, SEEK_SET);
+		sdtalist_chunk->write_header();
+	}
+	else
+	{
+		//Write RIFF header
+		fwrite("RIFF", 1, 4, out);
+		fwrite(&size, 4, 1, out);
+		fwrite("sfbk", 1, 4, out);
+
+		//Write all 3 chunks
+		infolist_chunk->write();
+		sdtalist_chunk->write();
+		pdtalist_chunk->write();
+		sdtalist_chunk->write_samples();
+	}
 
 	//Close output file
 	fclose(out);
@@ -169,11 +217,65 @@ void SF2::add_new_sample_header(const char *name, int start, int end, int start_
 	pdtalist_chunk->shdr_subchunk.add_sample(sfSample(this, name, start, end, start_loop, end_loop, sample_rate, original_pitch, pitch_correction));
 }
 
+// FNV-1a hash of a sample's parameters and source data
+static uint32_t sample_hash(SampleType type, uint32_t size, bool loop_flag, uint32_t loop_pos, const uint8_t *src, uint32_t src_size)
+{
+	uint32_t hash = 2166136261u;
+	uint32_t params[4] = {uint32_t(type), size, loop_flag, loop_pos};
+	const uint8_t *p = (const uint8_t*)params;
+	for (unsigned int i = 0; i < sizeof(params); i++)
+		hash = (hash ^ p[i]) * 16777619u;
+	for (uint32_t i = 0; i < src_size; i++)
+		hash = (hash ^ src[i]) * 16777619u;
+	return hash;
+}
+
 // Add a new sample and create corresponding header
-void SF2::add_new_sample(FILE *file, SampleType type, const char *name, uint32_t pointer, uint32_t size, bool loop_flag,
+// Samples with the same content as a previous one (even at another address or in another file)
+// share its data, and its header too if the pitch and sample rate are the same
+int SF2::add_new_sample(const DataView& file, SampleType type, const char *name, uint32_t pointer, uint32_t size, bool loop_flag,
 				  uint32_t loop_pos, uint32_t original_pitch, uint32_t pitch_correction, uint32_t sample_rate)
 {
-	uint32_t dir_offset = sdtalist_chunk->smpl_subchunk.add_sample(file, type, pointer, size, loop_flag, loop_pos);
+	if (!loop_flag) loop_pos = 0;
+	uint32_t src_size = SMPLSubChunk::source_size(type, size);
+	const uint8_t *src = file.at(pointer, src_size);
+	uint32_t hash = sample_hash(type, size, loop_flag, loop_pos, src, src_size);
+
+	SampleData *data = nullptr;
+	auto range = sample_data_map.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		SampleData& d = sample_data_list[it->second];
+		if (d.type == type && d.size == size && d.loop_flag == loop_flag && d.loop_pos == loop_pos
+			&& d.src_size == src_size && !memcmp(d.src, src, src_size))
+		{
+			data = &d;
+			break;
+		}
+	}
+
+	if (data)
+	{
+		for (const SampleData::Header& h : data->headers)
+			if (h.sample_rate == sample_rate && h.original_pitch == original_pitch && h.pitch_correction == pitch_correction)
+				return h.index;
+	}
+	else
+	{
+		SampleData d;
+		d.src = src;
+		d.src_size = src_size;
+		d.type = type;
+		d.size = size;
+		d.loop_flag = loop_flag;
+		d.loop_pos = loop_pos;
+		d.dir_offset = sdtalist_chunk->smpl_subchunk.add_sample(file, type, pointer, size, loop_flag, loop_pos);
+		sample_data_map.insert(std::make_pair(hash, sample_data_list.size()));
+		sample_data_list.push_back(d);
+		data = &sample_data_list.back();
+	}
+
+	uint32_t dir_offset = data->dir_offset;
 	// If the sample is looped const SF2 standard requires we add the 8 bytes
 	// at the start of the loop at the end (what a dumb standard)
 	uint32_t dir_end, dir_loop_end, dir_loop_start;
@@ -192,7 +294,10 @@ void SF2::add_new_sample(FILE *file, SampleType type, const char *name, uint32_t
 	}
 
 	// Create sample header and add it to the list
+	int index = get_shdr_size();
+	data->headers.push_back(SampleData::Header{sample_rate, original_pitch, pitch_correction, index});
 	add_new_sample_header(name, dir_offset, dir_end, dir_loop_start, dir_loop_end, sample_rate, original_pitch, pitch_correction);
+	return index;
 }
 
 uint16_t SF2::get_ibag_size()
@@ -224,3 +329,8 @@ uint16_t SF2::get_pmod_size()
 {
 	return pdtalist_chunk->pmod_subchunk.modulator_list.size();
 }
+
+uint16_t SF2::get_shdr_size()
+{
+	return pdtalist_chunk->shdr_subchunk.sample_list.size();
+}
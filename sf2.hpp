@@ -2,11 +2,15 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <vector>
+#include <unordered_map>
 #include "sf2_types.hpp"
+#include "data_view.hpp"
 
 class InfoListChunk;
 class SdtaListChunk;
 class HydraChunk;
+class PcmCache;
 class sfPresetHeader;
 class sfBag;
 class sfInst;
@@ -36,6 +40,33 @@ class SF2
 
 	void add_terminals();
 
+	// Sample data already added, identical samples share it instead of being written again
+	struct SampleData
+	{
+		const uint8_t *src;
+		uint32_t src_size;
+		SampleType type;
+		uint32_t size;
+		bool loop_flag;
+		uint32_t loop_pos;
+		uint32_t dir_offset;
+		// Headers using this data
+		struct Header
+		{
+			uint32_t sample_rate, original_pitch, pitch_correction;
+			int index;
+		};
+		std::vector<Header> headers;
+	};
+	std::vector<SampleData> sample_data_list;
+	// Content hash -> index in sample_data_list
+	std::unordered_multimap<uint32_t, size_t> sample_data_map;
+
+	// Position of the sample data list chunk in the output file when streaming, -1 otherwise
+	long stream_pos;
+	// Buffer of the output file
+	std::vector<char> out_buffer;
+
 // Forbid copy and affectation
 	SF2(SF2&);
 	SF2& operator=(SF2&);
@@ -44,9 +75,14 @@ public:
 	//Target file, should be assigned to a valid opened FILE in "wb" mode by user before "write()" is called.
 	FILE *out;
 	unsigned int default_sample_rate;
+	// Converted samples shared with other SF2 files built at the same time, nullptr if none
+	PcmCache *pcm_cache;
+	// Most threads converting samples when the file is written, 0 for one per processor
+	unsigned int threads;
 
 	SF2(unsigned int sample_rate = 22050);
 	~SF2();
+	void stream(FILE *outfile);
 	void write(FILE *outfile);
 	void add_new_preset(const char *name, int Patch, int Bank);
 	void add_new_instrument(const char *name);
@@ -62,13 +98,14 @@ public:
 	void add_new_inst_generator(SFGenerator operation, uint8_t lo, uint8_t hi);
 	void add_new_sample_header(const char *name, int start, int end, int start_loop, int end_loop, int sample_rate, int original_pitch, int pitch_correction);
 
-	void add_new_sample(FILE *file, SampleType type, const char *name, uint32_t pointer, uint32_t size, bool loop_flag,
+	// Add a new sample, returns the # of its header
+	int add_new_sample(const DataView& file, SampleType type, const char *name, uint32_t pointer, uint32_t size, bool loop_flag,
 				  uint32_t loop_pos, uint32_t original_pitch, uint32_t pitch_correction, uint32_t sample_rate);
 	// Add new sample using default sample rate
-	inline void add_new_sample(FILE *file, SampleType type, const char *name, uint32_t pointer, uint32_t size,
+	inline int add_new_sample(const DataView& file, SampleType type, const char *name, uint32_t pointer, uint32_t size,
 					  bool loop_flag, uint32_t loop_pos, uint32_t original_pitch, uint32_t pitch_correction)
 	{
-		add_new_sample(file, type, name, pointer, size, loop_flag, loop_pos, original_pitch, pitch_correction, default_sample_rate);
+		return add_new_sample(file, type, name, pointer, size, loop_flag, loop_pos, original_pitch, pitch_correction, default_sample_rate);
 	}
 
 	uint16_t get_ibag_size();
@@ -77,4 +114,5 @@ public:
 	uint16_t get_pbag_size();
 	uint16_t get_pgen_size();
 	uint16_t get_pmod_size();
+	uint16_t get_shdr_size();
 };
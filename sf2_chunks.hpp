@@ -46,7 +46,18 @@
 #include <cstdint>
 #include "sf2.hpp"
 #include "sf2_types.hpp"
+#include "pcm_convert.hpp"
+#include "pcm_cache.hpp"
 #include <vector>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <atomic>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 // SF2Chunks abstract class
 // All Chunks and SubChunks should extend this class.
@@ -80,6 +91,8 @@ protected:
 
 /*
  * Helper classes
+ *
+ * Records have the exact layout they have in SF2 files, so lists of them are written at once.
  */
 
 // Preset header class
@@ -92,20 +105,15 @@ class sfPresetHeader
 	const uint32_t dwLibrary = 0;		// Unused values - should be kept to 0
 	const uint32_t dwGenre = 0;
 	const uint32_t dwMorphology = 0;
-	SF2 *sf2;
 public:
 	sfPresetHeader(SF2 *sf2, const char *name, uint16_t patch, uint16_t bank) :
-		wPreset(patch), wBank(bank), sf2(sf2)
+		wPreset(patch), wBank(bank)
 	{
 		strncpy(ach_preset_name, name, 20);
 		wPresetBagNdx = sf2->get_pbag_size();
 	}
-
-	void write()
-	{
-		fwrite(&ach_preset_name, 1, 38, sf2->out);
-	}
 }__attribute__ ((packed));
+static_assert(sizeof(sfPresetHeader) == 38, "sfPresetHeader should be 38 bytes long like in SF2 files");
 
 // Preset bag class
 class sfBag
@@ -114,11 +122,9 @@ class sfBag
 	// indexes which are automatically created....
 	uint16_t wGenNdx;			// Index to list of generators
 	uint16_t wModNdx;			// Index to list of modulators
-	SF2 *sf2;
 public:
 	// Automatically assign indexes
-	sfBag(SF2 *sf2, bool preset) :
-		sf2(sf2)
+	sfBag(SF2 *sf2, bool preset)
 	{
 		if (preset)
 		{
@@ -131,12 +137,8 @@ public:
 			wModNdx = sf2->get_imod_size();
 		}
 	}
-
-	void write()
-	{
-		fwrite(&wGenNdx, 2, 2, sf2->out);
-	}
-};
+}__attribute__ ((packed));
+static_assert(sizeof(sfBag) == 4, "sfBag should be 4 bytes long like in SF2 files");
 
 // Modulator class (mostly unused)
 class sfModList
@@ -146,22 +148,16 @@ class sfModList
 	uint16_t modAmount;				// Modulator value
 	SFModulator sfModAmtSrcOper;	// Modulator source ??
 	SFTransform sfModTransOper;		// Transformation curvative
-	SF2 *sf2;
 public:
 	sfModList(SF2 *sf2) :
 		sfModSrcOper(SFModulator::_null),
 		sfModDestOper(SFGenerator::_null),
 		modAmount(0),
 		sfModAmtSrcOper(SFModulator::_null),
-		sfModTransOper(SFTransform::_null),
-		sf2(sf2)
+		sfModTransOper(SFTransform::_null)
 	{}
-
-	void write()
-	{
-		fwrite(&sfModSrcOper, 2, 5, sf2->out);
-	}
-};
+}__attribute__ ((packed));
+static_assert(sizeof(sfModList) == 10, "sfModList should be 10 bytes long like in SF2 files");
 
 // Generator class
 // This is extremely important
@@ -169,43 +165,33 @@ class sfGenList
 {
 	SFGenerator sfGenOper;
 	genAmountType genAmount;
-	SF2 *sf2;
 public:
 	sfGenList(SF2 *sf2) :
-		sfGenOper(SFGenerator::_null), sf2(sf2)
+		sfGenOper(SFGenerator::_null)
 	{
 		genAmount.shAmount = 0;
 	}
 	// Straightforward constructor
 	sfGenList(SF2 *sf2, SFGenerator operation, genAmountType amount) :
-		sfGenOper(operation), genAmount(amount), sf2(sf2)
+		sfGenOper(operation), genAmount(amount)
 	{}
-
-	void write()
-	{
-		fwrite(&sfGenOper, 2, 2, sf2->out);
-	}
 };
+static_assert(sizeof(sfGenList) == 4, "sfGenList should be 4 bytes long like in SF2 files");
 
 // Instrument zone class
 class sfInst
 {
 	char achInstName[20];
 	uint16_t wInstBagNdx;
-	SF2 *sf2;
 public:
 	// Constructor that automatically points at the end of the (current) preset bag
-	sfInst(SF2 *sf2, const char *name) : sf2(sf2)
+	sfInst(SF2 *sf2, const char *name)
 	{
 		strncpy(achInstName, name, 20);
 		wInstBagNdx = sf2->get_ibag_size();
 	}
-
-	void write()
-	{
-		fwrite(&achInstName, 1, 22, sf2->out);
-	}
-};
+}__attribute__ ((packed));
+static_assert(sizeof(sfInst) == 22, "sfInst should be 22 bytes long like in SF2 files");
 
 class sfSample
 {
@@ -219,7 +205,6 @@ class sfSample
 	int8_t chPitchCorrection;
 	uint16_t wSampleLink;
 	SFSampleLink sfSampleType;
-	SF2 *sf2;
 public:
 	sfSample(SF2 *sf2, const char *name, uint32_t start, uint32_t end, uint32_t start_loop, uint32_t end_loop, uint32_t sample_rate, int8_t original_pitch, int8_t pitch_correction) :
 		dwStart(start),
@@ -230,17 +215,12 @@ public:
 		byOriginalPitch(original_pitch),
 		chPitchCorrection(pitch_correction),
 		wSampleLink(0),
-		sfSampleType(SFSampleLink::monoSample),
-		sf2(sf2)
+		sfSampleType(SFSampleLink::monoSample)
 	{
 		strncpy(achSampleName, name, 20);
 	}
-
-	void write()
-	{
-		fwrite(&achSampleName, 1, 46, sf2->out);
-	}
-};
+}__attribute__ ((packed));
+static_assert(sizeof(sfSample) == 46, "sfSample should be 46 bytes long like in SF2 files");
 
 /* sub-chunk classes
  *
@@ -289,34 +269,174 @@ class SMPLSubChunk : public SF2Chunks
 	// To prevent the program from using a lot of memory by caching all
 	// samples before writing them (which is not useful)
 	// I instead store a list of pointers to sample data, and the data
-	// is directly read from the original file when the sample should
-	// be written to output
+	// is directly converted from the original file (loaded in memory)
+	// when the sample should be written to output
 
 	// I made this function as generic as possible, so any sample can be loaded
 	// from any file, in various formats.
 
-	std::vector<FILE*> file_list;				// Files from which the samples must be read
+	std::vector<DataView> file_list;			// Files from which the samples must be read
 	std::vector<uint32_t> pointer_list;			// address within files where the samples must be read
 	std::vector<uint32_t> size_list;			// Size of the data sample
 	std::vector<bool> loop_flag_list;			// Loop flag for samples (required as we need to copy data after the loop)
 	std::vector<uint32_t> loop_pos_list;		// Loop start data (irrelevent if loop flag is clear - add dummy data)
 	std::vector<SampleType> sample_type_list;	// Type of sample (unsigned / signed, 8/16 bits etc...)
 
+	// Number of samples written for sample i: its own samples, the 8 samples after
+	// the loop point and the 46 dummy zeroed samples
+	uint32_t total_size(unsigned int i) const
+	{
+		return size_list[i] + (loop_flag_list[i] ? 8 : 0) + 46;
+	}
+
+	// Convert sample i to output format
+	void convert(unsigned int i, int16_t *outbuf) const
+	{
+		convert(file_list[i], sample_type_list[i], pointer_list[i], size_list[i], loop_flag_list[i], loop_pos_list[i], outbuf);
+	}
+
+	// Convert a sample to output format, or copy it from the cache shared with other SF2 files
+	void convert(const DataView& file, SampleType type, uint32_t pointer, uint32_t size, bool loop_flag, uint32_t loop_pos, int16_t *outbuf) const
+	{
+		if (sf2->pcm_cache)
+		{
+			PcmKey key = {file.at(pointer, source_size(type, size)), type, size, loop_flag, loop_pos};
+			sf2->pcm_cache->copy(key, size + (loop_flag ? 8 : 0) + 46, outbuf, [&](int16_t *pcm)
+			{
+				decode(file, type, pointer, size, loop_flag, loop_pos, pcm);
+			});
+		}
+		else
+			decode(file, type, pointer, size, loop_flag, loop_pos, outbuf);
+	}
+
+	static void decode(const DataView& file, SampleType type, uint32_t pointer, uint32_t size, bool loop_flag, uint32_t loop_pos, int16_t *outbuf)
+	{
+		const uint8_t *src = file.at(pointer, source_size(type, size));
+
+		switch (type)
+		{
+			// Source is unsigned 8 bits
+			case UNSIGNED_8:
+				// Convert to signed 16 bits
+				pcm_u8_to_s16(src, outbuf, size);
+				break;
+
+			// Source is signed 8 bits
+			case SIGNED_8:
+				pcm_s8_to_s16(src, outbuf, size);
+				break;
+
+			case SIGNED_16:
+				// Just copy raw data, no conversion needed
+				memcpy(outbuf, src, 2 * size);
+				break;
+
+			case GAMEBOY_CH3:
+			{
+				// Conversion lookup table
+				const int16_t conv_tbl[] =
+				{
+					-0x4000, -0x3800, -0x3000, -0x2800, -0x2000, -0x1800, -0x0100, -0x0800,
+					0x0000, 0x0800, 0x1000, 0x1800, 0x2000, 0x2800, 0x3000, 0x3800
+				};
+
+				int num_of_repts = size/32;
+				for (int j=0, l=0; j<16; j++)
+				{
+					for (int k=num_of_repts; k!=0; k--, l++)
+						outbuf[l] = conv_tbl[src[j]>>4];
+
+					for (int k=num_of_repts; k!=0; k--, l++)
+						outbuf[l] = conv_tbl[src[j]&0xf];
+				}
+			}	break;
+
+			case BDPCM:
+				pcm_bdpcm_to_s16(src, outbuf, size);
+				break;
+		}
+
+		// If loop enabled, add 8 samples after loop point
+		// (required by the dumb SF2 standard)
+		int16_t *end = outbuf + size;
+		if (loop_flag)
+		{
+			memmove(end, outbuf + loop_pos, 2*8);
+			end += 8;
+		}
+
+		// Add 46 dummy zeroed samples at the end
+		// which is also required by the very dumb SF2 standard
+		memset(end, 0, 2*46);
+	}
+
+	// Write all samples to output in little Indian format, one after the other
+	void write_sequential()
+	{
+		// Every sample is converted in this buffer and written at once
+		std::vector<int16_t> buffer;
+
+		for (unsigned int i=0; i<file_list.size(); i++)
+		{
+			if (buffer.size() < total_size(i)) buffer.resize(total_size(i));
+			convert(i, buffer.data());
+			fwrite(buffer.data(), 2, total_size(i), sf2->out);
+		}
+	}
+
+	// Where the samples should be written in the output file, when the rest of the file
+	// is written first, -1 otherwise
+	long data_offset = -1;
+
+	// Samples are written as soon as they're added, they aren't kept in the lists
+	bool streaming = false;
+	std::vector<int16_t> stream_buffer;
+
 public:
 	SMPLSubChunk(SF2 *sf2) :
 		SF2Chunks(sf2, "smpl")
 	{}
 
+	// Size in bytes of the source data of a sample
+	static uint32_t source_size(SampleType type, uint32_t size)
+	{
+		switch (type)
+		{
+			case SIGNED_16:
+				return 2 * size;
+			case GAMEBOY_CH3:
+				return 16;					// Data is always on 16 bytes
+			case BDPCM:
+				return size / 64 * 33;		// 33 bytes for a block of 64 samples
+			default:
+				return size;
+		}
+	}
+
 	// Add a sample to the package
 	// Returns directory index of the start of the sample
-	uint32_t add_sample(FILE *file, SampleType type, uint32_t pointer, uint32_t size, bool loop_flag, uint32_t loop_pos)
+	// Throws -1 if the sample data isn't entirely within the file
+	uint32_t add_sample(const DataView& file, SampleType type, uint32_t pointer, uint32_t size, bool loop_flag, uint32_t loop_pos)
 	{
-		file_list.push_back(file);
-		pointer_list.push_back(pointer);
-		size_list.push_back(size);
-		loop_flag_list.push_back(loop_flag);
-		loop_pos_list.push_back(loop_pos);
-		sample_type_list.push_back(type);
+		file.at(pointer, source_size(type, size));
+
+		if (streaming)
+		{
+			uint32_t total_size = size + (loop_flag ? 8 : 0) + 46;
+			if (stream_buffer.size() < total_size) stream_buffer.resize(total_size);
+			convert(file, type, pointer, size, loop_flag, loop_pos, stream_buffer.data());
+			fwrite(stream_buffer.data(), 2, total_size, sf2->out);
+		}
+		else
+		{
+			file_list.push_back(file);
+			pointer_list.push_back(pointer);
+			size_list.push_back(size);
+			loop_flag_list.push_back(loop_flag);
+			loop_pos_list.push_back(loop_pos);
+			sample_type_list.push_back(type);
+		}
 
 		uint32_t dir_offset = SF2Chunks::size >> 1;
 		// 2 bytes per sample
@@ -330,130 +450,91 @@ public:
 		return dir_offset;
 	}
 
+	// Write the header of the chunk, then samples as soon as they're added
+	void start_stream()
+	{
+		SF2Chunks::write();
+		streaming = true;
+	}
+
+	// Write the header of the chunk only (samples are already written when streaming)
+	void write_header()
+	{
+		SF2Chunks::write();
+	}
+
 	// Write all samples to output in little Indian format
+	//
+	// When possible, only room for the samples is left in the output file, and write_mapped()
+	// converts them once the rest of the file is written.
 	void write()
 	{
 		SF2Chunks::write();
 
-		for (unsigned int i=0; i<file_list.size(); i++)
+#ifndef _WIN32
+		long pos = ftell(sf2->out);
+		if (pos >= 0 && !(pos & 1) && !fseek(sf2->out, SF2Chunks::size, SEEK_CUR))
 		{
-			// Seek at the start of the sample in input file
-			fseek(file_list[i], pointer_list[i], SEEK_SET);
+			data_offset = pos;
+			return;
+		}
+#endif
+		write_sequential();
+	}
+
+	// Write the samples which write() left room for, directly in the output file mapped in memory.
+	// Samples are converted in parallel, each one to its place within the file.
+	// This should be called after the whole file is written.
+	void write_mapped()
+	{
+		if (data_offset < 0) return;
+		long offset = data_offset;
+		data_offset = -1;
 
-			// Using a cached buffer really speeds up the writing process a lot !!
-			int16_t *outbuf = new int16_t[size_list[i]];
+#ifndef _WIN32
+		fflush(sf2->out);
+		int fd = fileno(sf2->out);
+		long page_size = sysconf(_SC_PAGESIZE);
+		off_t map_offset = offset / page_size * page_size;
+		size_t map_size = offset - map_offset + SF2Chunks::size;
 
-			switch (sample_type_list[i])
-			{
-				// Source is unsigned 8 bits
-				case UNSIGNED_8:
-				{
-					uint8_t *data = new uint8_t[size_list[i]];
-					fread(data, 1, size_list[i], file_list[i]);
-					// Convert to signed 16 bits
-					for (unsigned int j=0; j < size_list[i]; j++)
-						outbuf[j] = (data[j] - 0x80) << 8;
-					delete[] data;
-				}	break;
-
-				// Source is signed 8 bits
-				case SIGNED_8:
-				{
-					int8_t *data = new int8_t[size_list[i]];
-					fread(data, 1, size_list[i], file_list[i]);
+		// Allocate disk space now, running out of it while writing to the mapping would crash
+		void *map = MAP_FAILED;
+		if (SF2Chunks::size && !posix_fallocate(fd, offset, SF2Chunks::size))
+			map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map_offset);
 
-					for (unsigned int j=0; j < size_list[i]; j++)
-						outbuf[j] = data[j] << 8;
-					delete[] data;
-				}	break;
+		if (map != MAP_FAILED)
+		{
+			int16_t *data = (int16_t*)((uint8_t*)map + (offset - map_offset));
 
-				case SIGNED_16:
-					// Just read raw data, no conversion needed
-					fread(outbuf, 2, size_list[i], file_list[i]);
-					break;
+			std::vector<uint32_t> start_list(file_list.size());
+			for (unsigned int i=0, start=0; i<file_list.size(); start += total_size(i), i++)
+				start_list[i] = start;
 
-				case GAMEBOY_CH3:
-				{
-					// Conversion lookup table
-					const int16_t conv_tbl[] =
-					{
-						-0x4000, -0x3800, -0x3000, -0x2800, -0x2000, -0x1800, -0x0100, -0x0800,
-						0x0000, 0x0800, 0x1000, 0x1800, 0x2000, 0x2800, 0x3000, 0x3800
-					};
-
-					int num_of_repts = size_list[i]/32;
-					// Data is always on 16 bytes
-					uint8_t data[16];
-					fread(data, 1, 16, file_list[i]);
-
-					for (int j=0, l=0; j<16; j++)
-					{
-						for (int k=num_of_repts; k!=0; k--, l++)
-							outbuf[l] = conv_tbl[data[j]>>4];
-
-						for (int k=num_of_repts; k!=0; k--, l++)
-							outbuf[l] = conv_tbl[data[j]&0xf];
-					}
-				}	break;
-
-				case BDPCM:
-				{
-					static const int8_t delta_lut[] = {0, 1, 4, 9, 16, 25, 36, 49, -64, -49, -36, -25, -16, -9, -4, -1};
-
-					/*
-					 * A block consists of an initial signed 8 bit PCM byte
-					 * followed by 63 nibbles stored in 32 bytes.
-					 * The first of these bytes has a zero padded (unused) high nibble.
-					 * This makes up of a total block size of 65 (0x21) bytes each.
-					 *
-					 * Decoding works like this:
-					 * The initial byte can be directly read without decoding. Then each
-					 * next sample can be decoded by putting the nibble into the delta-lookup-table
-					 * and adding that value to the previously calculated sample
-					 * until the end of the block is reached.
-					 */
-
-					unsigned int nblocks = size_list[i] / 64;		// 64 samples per block
-
-					char (*data)[33] = new char[nblocks][33];
-					fread(data, 33, nblocks, file_list[i]);
-
-					for (unsigned int block=0; block < nblocks; ++block)
-					{
-						int8_t sample = data[block][0];
-						outbuf[64*block] = sample << 8;
-						sample += delta_lut[data[block][1] & 0xf];
-						outbuf[64*block+1] = sample << 8;
-						for (unsigned int j = 1; j < 32; ++j)
-						{
-							uint8_t d = data[block][j+1];
-							sample += delta_lut[d >> 4];
-							outbuf[64*block+2*j] = sample << 8;
-							sample += delta_lut[d & 0xf];
-							outbuf[64*block+2*j+1]= sample << 8;
-						}
-					}
-					memset(outbuf+64*nblocks, 0, size_list[i]-64*nblocks);		// Remaining samples are always 0
-
-					delete[] data;
-				}   break;
-			}
-
-			// Write buffer
-			fwrite(outbuf, 2, size_list[i], sf2->out);
-
-			// If loop enabled, write 8 samples after loop point
-			// (required by the dumb SF2 standard)
-			if (loop_flag_list[i])
-				fwrite(outbuf + loop_pos_list[i], 2, 8, sf2->out);
-
-			// Write 46 dummy zeroed samples at the end
-			// which is also required by the very dumb SF2 standard
-			for (int j = 0; j < 2*46; j++)
-				putc(0x00, sf2->out);
-
-			delete[] outbuf;
+			// Threads take the next sample to convert until there are none left
+			std::atomic<unsigned int> next_sample(0);
+			auto convert_samples = [&]()
+			{
+				for (unsigned int i; (i = next_sample++) < file_list.size();)
+					convert(i, data + start_list[i]);
+			};
+
+			unsigned int max_threads = sf2->threads ? sf2->threads : std::thread::hardware_concurrency();
+			unsigned int thread_count = std::max(1u, std::min<unsigned int>(max_threads, file_list.size()));
+			std::vector<std::thread> threads;
+			for (unsigned int i=1; i<thread_count; i++)
+				threads.push_back(std::thread(convert_samples));
+			convert_samples();
+			for (unsigned int i=0; i<threads.size(); i++)
+				threads[i].join();
+
+			munmap(map, map_size);
+			return;
 		}
+#endif
+		// The file can't be mapped, write samples normally
+		fseek(sf2->out, offset, SEEK_SET);
+		write_sequential();
 	}
 };
 
@@ -470,16 +551,13 @@ public:
 	void add_preset(const sfPresetHeader& preset)
 	{
 		preset_list.push_back(preset);
-		size += 38;				// Each entry is exactly 38 bytes long
+		size += sizeof(sfPresetHeader);
 	}
 
 	void write()
 	{
 		SF2Chunks::write();
-
-		// Call the write function for all elements of the list
-		for (unsigned int i=0; i<preset_list.size(); i++)
-			preset_list[i].write();
+		fwrite(preset_list.data(), sizeof(sfPresetHeader), preset_list.size(), sf2->out);
 	}
 };
 
@@ -496,15 +574,13 @@ public:
 	void add_instrument(const sfInst& instrument)
 	{
 		instrument_list.push_back(instrument);
-		size += 22;
+		size += sizeof(sfInst);
 	}
 
 	void write()
 	{
 		SF2Chunks::write();
-
-		for (unsigned int i=0; i<instrument_list.size(); i++)
-			instrument_list[i].write();
+		fwrite(instrument_list.data(), sizeof(sfInst), instrument_list.size(), sf2->out);
 	}
 };
 
@@ -524,16 +600,13 @@ public:
 	void add_bag(const sfBag& bag)
 	{
 		bag_list.push_back(bag);
-		size += 4;				// Each entry is exactly 4 bytes long
+		size += sizeof(sfBag);
 	}
 
 	void write()
 	{
 		SF2Chunks::write();
-
-		// Call the write function for all elements of the list
-		for (unsigned int i=0; i<bag_list.size(); i++)
-			bag_list[i].write();
+		fwrite(bag_list.data(), sizeof(sfBag), bag_list.size(), sf2->out);
 	}
 };
 
@@ -558,15 +631,13 @@ public:
 	void add_modulator(const sfModList& modulator)
 	{
 		modulator_list.push_back(modulator);
-		size += 10;
+		size += sizeof(sfModList);
 	}
 
 	void write()
 	{
 		SF2Chunks::write();
-
-		for (unsigned int i=0; i<modulator_list.size(); i++)
-			modulator_list[i].write();
+		fwrite(modulator_list.data(), sizeof(sfModList), modulator_list.size(), sf2->out);
 	}
 };
 
@@ -591,15 +662,13 @@ public:
 	void add_generator(const sfGenList& generator)
 	{
 		generator_list.push_back(generator);
-		size += 4;
+		size += sizeof(sfGenList);
 	}
 
 	void write()
 	{
 		SF2Chunks::write();
-
-		for (unsigned int i=0; i<generator_list.size(); i++)
-			generator_list[i].write();
+		fwrite(generator_list.data(), sizeof(sfGenList), generator_list.size(), sf2->out);
 	}
 };
 
@@ -607,6 +676,8 @@ public:
 class SHDRSubChunk : public SF2Chunks
 {
 	std::vector<sfSample> sample_list;
+
+	friend uint16_t SF2::get_shdr_size();
 public:
 	SHDRSubChunk(SF2 *sf2) :
 		SF2Chunks(sf2, "shdr")
@@ -616,15 +687,13 @@ public:
 	void add_sample(const sfSample& sample)
 	{
 		sample_list.push_back(sample);
-		size += 46;
+		size += sizeof(sfSample);
 	}
 
 	void write()
 	{
 		SF2Chunks::write();
-
-		for (unsigned int i=0; i<sample_list.size(); i++)
-			sample_list[i].write();
+		fwrite(sample_list.data(), sizeof(sfSample), sample_list.size(), sf2->out);
 	}
 };
 
@@ -683,7 +752,7 @@ class SdtaListChunk : public SF2Chunks
 {
 	SMPLSubChunk smpl_subchunk;
 
-	friend void SF2::add_new_sample(FILE *file, SampleType type, const char *name, uint32_t pointer, uint32_t size, bool loop_flag,
+	friend int SF2::add_new_sample(const DataView& file, SampleType type, const char *name, uint32_t pointer, uint32_t size, bool loop_flag,
 				  uint32_t loop_pos, uint32_t original_pitch, uint32_t pitch_correction, uint32_t sample_rate);
 public:
 	SdtaListChunk (SF2 *sf2) :
@@ -706,6 +775,28 @@ public:
 
 		smpl_subchunk.write();
 	}
+
+	// Write samples which have been left for when the whole file is written
+	void write_samples()
+	{
+		smpl_subchunk.write_mapped();
+	}
+
+	// Write the headers of the chunk, then samples as soon as they're added
+	void start_stream()
+	{
+		SF2Chunks::write();
+		fwrite("sdta", 1, 4, sf2->out);
+		smpl_subchunk.start_stream();
+	}
+
+	// Write the headers of the chunk only (samples are already written when streaming)
+	void write_header()
+	{
+		SF2Chunks::write();
+		fwrite("sdta", 1, 4, sf2->out);
+		smpl_subchunk.write_header();
+	}
 };
 
 // Hydra chunk, contains data for instruments, presets and samples header
@@ -742,6 +833,7 @@ class HydraChunk : public SF2Chunks
 	friend uint16_t SF2::get_pbag_size();
 	friend uint16_t SF2::get_pmod_size();
 	friend uint16_t SF2::get_pgen_size();
+	friend uint16_t SF2::get_shdr_size();
 
 public:
 	// Constructor
@@ -6,6 +6,7 @@
  */
 
 #include "midi.hpp"
+#include "song_usage.hpp"
 #include <algorithm>
 #include <forward_list>
 #include <cstdio>
@@ -51,6 +52,11 @@ static bool sv = false;
 static MIDI midi(24);
 static FILE *inGBA;
 
+// Programs and keys played, written to the usage file if one is given
+static const char *usage_name = nullptr;
+static int program[16];
+static BankUsage usage;
+
 static void process_event(int track);
 
 static void print_instructions()
@@ -66,12 +72,21 @@ static void print_instructions()
 		"-gs : This will send a GS system exclusive message to tell the player channel 10 is not drums.\n"
 		"-xg : This will send a XG system exclusive message, and force banks number which will disable \"drums\".\n"
 		"-lv : Linearise volume and velocities. This should be used to have the output \"sound\" like the original song, but shouldn't be used to get an exact dump of sequence data."
-		"-sv : Simulate vibrato. This will insert controllers in real time to simulate a vibrato, instead of just when commands are given. Like -lv, this should be used to have the output \"sound\" like the original song, but shouldn't be used to get an exact dump of sequence data.\n\n"
+		"-sv : Simulate vibrato. This will insert controllers in real time to simulate a vibrato, instead of just when commands are given. Like -lv, this should be used to have the output \"sound\" like the original song, but shouldn't be used to get an exact dump of sequence data.\n"
+		"-u  : Usage; -u followed by a file name appends the programs used by the song and the keys they play to this file, for sound_font_ripper -u.\n\n"
 		"It is possible, but not recommended, to use more than one of these flags at a time.\n"
 	);
 	exit(0);
 }
 
+// Record that the program of a track is played at this key
+static void add_usage(int track, int key)
+{
+	if (key < 0) key = 0;
+	if (key > 127) key = 127;
+	usage.add(program[track], key, key);
+}
+
 static void add_simultaneous_note()
 {
 	// Update simultaneous notes max.
@@ -363,6 +378,7 @@ static void process_event(int track)
 		// Linearise velocity if needed
 		if (lv) vel = sqrt(127.0 * vel);
 
+		add_usage(track, key + key_shift[track]);
 		notes_playing.push_front( Note(midi, track, lenTbl[command - 0xd0 + 1] + len_ofs, key + key_shift[track], vel) );
 		return;
 	}
@@ -388,6 +404,7 @@ static void process_event(int track)
 				}
 			}
 			midi.add_pchange(track, arg1);
+			program[track] = arg1 & 0x7f;
 			return;
 
 		// Set volume
@@ -526,6 +543,7 @@ static void process_event(int track)
 			if (lv) vel = (int)sqrt(127.0 * vel);
 
 			// Make note of infinite length
+			add_usage(track, key + key_shift[track]);
 			notes_playing.push_front(Note(midi, track, -1, key + key_shift[track], vel));
 		}	return;
 
@@ -566,6 +584,8 @@ static uint32_t parseArguments(const int argv, const char *const args[])
 				lv = true;
 			else if (args[i][1] == 's' && args[i][2] == 'v')
 				sv = true;
+			else if (args[i][1] == 'u' && args[i][2])
+				usage_name = args[i] + 2;
 			else
 				print_instructions();
 		}
@@ -683,6 +703,9 @@ int main(int argc, char *argv[])
 
 	printf(" Maximum simultaneous notes: %d\n", simultaneous_notes_max);
 
+	if (usage_name && !save_bank_usage(usage_name, instr_bank_address, usage))
+		fprintf(stderr, "Can't write to usage file %s.\n", usage_name);
+
 	printf("Dump complete. Now outputting MIDI file...");
 	midi.write(outMID);
 	// Close files
@@ -0,0 +1,84 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Instruments used by songs: song_ripper records the programs of every sound bank
+ * played by a song and the range of keys they play, and sound_font_ripper can then
+ * convert only those instead of whole banks.
+ *
+ * The file is a text file with a line per (bank, program) pair:
+ *   bank_address program lowest_key highest_key
+ * song_ripper appends its lines to the file, so the usages of several songs add up.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+
+// Keys played with each program of a sound bank
+struct BankUsage
+{
+	int key_lo[128];
+	int key_hi[128];
+
+	BankUsage()
+	{
+		for (int i = 0; i < 128; i++)
+		{
+			key_lo[i] = 128;
+			key_hi[i] = -1;
+		}
+	}
+
+	bool used(int program) const
+	{
+		return key_lo[program] <= key_hi[program];
+	}
+
+	void add(int program, int key_lo, int key_hi)
+	{
+		if (key_lo < this->key_lo[program]) this->key_lo[program] = key_lo;
+		if (key_hi > this->key_hi[program]) this->key_hi[program] = key_hi;
+	}
+};
+
+// Sound bank address -> usage
+typedef std::map<uint32_t, BankUsage> SongUsage;
+
+// Append the used programs of a bank to a usage file, returns false if it can't be written
+static inline bool save_bank_usage(const std::string& filename, uint32_t bank, const BankUsage& usage)
+{
+	FILE *f = fopen(filename.c_str(), "a");
+	if (!f) return false;
+	for (int program = 0; program < 128; program++)
+		if (usage.used(program))
+			fprintf(f, "0x%x %d %d %d\n", bank, program, usage.key_lo[program], usage.key_hi[program]);
+	return !fclose(f);
+}
+
+// Read a whole usage file, returns false if it can't be read or is invalid
+static inline bool load_song_usage(const std::string& filename, SongUsage& usage)
+{
+	FILE *f = fopen(filename.c_str(), "r");
+	if (!f) return false;
+
+	bool ok = true;
+	unsigned int bank;
+	int program, key_lo, key_hi;
+	int n;
+	while ((n = fscanf(f, "%x %d %d %d", &bank, &program, &key_lo, &key_hi)) == 4)
+	{
+		if (program < 0 || program > 127 || key_lo < 0 || key_hi > 127 || key_lo > key_hi)
+		{
+			ok = false;
+			break;
+		}
+		usage[bank].add(program, key_lo, key_hi);
+	}
+	if (n != EOF) ok = false;
+	fclose(f);
+	return ok;
+}
@@ -0,0 +1,150 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * (c) 2012, 2014 Bregalad
+ * This is free and open source software
+ *
+ * This class converts GBA instruments to SF2 presets
+ */
+
+#include "sound_font_builder.hpp"
+#include <cmath>
+#include "hex_string.hpp"
+
+// General MIDI instrument names
+static const char *const general_MIDI_instr_names[128] =
+{
+	"Acoustic Grand Piano", "Bright Acoustic Piano", "Electric Grand Piano", "Honky-tonk Piano", "Rhodes Piano", "Chorused Piano",
+	"Harpsichord",	"Clavinet", "Celesta", "Glockenspiel", "Music Box", "Vibraphone", "Marimba", "Xylophone", "Tubular Bells", "Dulcimer",
+	"Hammond Organ", "Percussive Organ", "Rock Organ", "Church Organ", "Reed Organ", "Accordion", "Harmonica", "Tango Accordion",
+	"Acoustic Guitar (nylon)", "Acoustic Guitar (steel)", "Electric Guitar (jazz)", "Electric Guitar (clean)", "Electric Guitar (muted)",
+	"Overdriven Guitar", "Distortion Guitar", "Guitar Harmonics", "Acoustic Bass", "Electric Bass (finger)", "Electric Bass (pick)",
+	"Fretless Bass", "Slap Bass 1", "Slap Bass 2", "Synth Bass 1", "Synth Bass 2", "Violin", "Viola", "Cello", "Contrabass",
+	"Tremelo Strings", "Pizzicato Strings", "Orchestral Harp", "Timpani", "String Ensemble 1", "String Ensemble 2", "SynthStrings 1",
+	"SynthStrings 2", "Choir Aahs", "Voice Oohs", "Synth Voice", "Orchestra Hit", "Trumpet", "Trombone", "Tuba", "Muted Trumpet",
+	"French Horn", "Brass Section", "Synth Brass 1", "Synth Brass 2", "Soprano Sax", "Alto Sax", "Tenor Sax", "Baritone Sax",
+	"Oboe", "English Horn", "Bassoon", "Clarinet", "Piccolo", "Flute", "Recorder", "Pan Flute", "Bottle Blow", "Shakuhachi", "Whistle",
+	"Ocarina", "Lead 1 (square)", "Lead 2 (sawtooth)", "Lead 3 (calliope lead)", "Lead 4 (chiff lead)", "Lead 5 (charang)",
+	"Lead 6 (voice)", "Lead 7 (fifths)", "Lead 8 (bass + lead)", "Pad 1 (new age)", "Pad 2 (warm)", "Pad 3 (polysynth)", "Pad 4 (choir)",
+	"Pad 5 (bowed)", "Pad 6 (metallic)", "Pad 7 (halo)", "Pad 8 (sweep)", "FX 1 (rain)", "FX 2 (soundtrack)", "FX 3 (crystal)",
+	"FX 4 (atmosphere)", "FX 5 (brightness)", "FX 6 (goblins)",	"FX 7 (echoes)", "FX 8 (sci-fi)", "Sitar", "Banjo", "Shamisen", "Koto",
+	"Kalimba", "Bagpipe", "Fiddle", "Shanai", "Tinkle Bell", "Agogo", "Steel Drums", "Woodblock", "Taiko Drum", "Melodic Tom",
+	"Synth Drum", "Reverse Cymbal", "Guitar Fret Noise", "Breath Noise", "Seashore", "Bird Tweet", "Telephone Ring", "Helicopter",
+	"Applause", "Gunshot"
+};
+
+SoundFontBuilder::SoundFontBuilder(const GBASoundData& data, unsigned int sample_rate, unsigned int main_volume, bool gm_preset_names) :
+	data(data),
+	sf2(sample_rate),
+	instruments(&sf2, data),
+	main_volume(main_volume),
+	gm_preset_names(gm_preset_names)
+{}
+
+// Add initial attenuation preset to balance between GameBoy and sampled instruments
+void SoundFontBuilder::add_attenuation_preset()
+{
+	if (main_volume < 15)
+	{
+		const uint16_t attenuation = uint16_t(100.0 * log(15.0/main_volume));
+		sf2.add_new_preset_generator(SFGenerator::initialAttenuation, attenuation);
+	}
+}
+
+// Convert a GBA instrument in its SF2 counterpart
+// if any kind of error happens, it will do nothing and exit
+void SoundFontBuilder::build_instrument(const GraphInstrument& instr, unsigned int bank, unsigned int instrument, int key_lo, int key_hi)
+{
+	uint8_t instr_type = instr.type();
+	std::string name;
+	if (gm_preset_names)
+		name = std::string(general_MIDI_instr_names[instrument]);
+	else
+		// (poetic) name of the SF2 preset...
+		name = "Type " + std::to_string(instr_type) + " @0x" + hex(instr.address);
+
+	try
+	{
+		switch (instr_type)
+		{	// Sampled instrument types
+			case 0x00:
+			case 0x08:
+			case 0x10:
+			case 0x18:
+			case 0x20:
+			case 0x28:
+			case 0x30:
+			case 0x38:
+			{
+				int i = instruments.build_sampled_instrument(instr);
+				sf2.add_new_preset(name.c_str(), instrument, bank);
+				sf2.add_new_preset_bag();
+				// Add initial attenuation preset to balance volume between sampled and GB instruments
+				add_attenuation_preset();
+				sf2.add_new_preset_generator(SFGenerator::instrument, i);
+			}	break;
+
+			// GameBoy pulse wave instruments
+			case 0x01:
+			case 0x02:
+			case 0x09:
+			case 0x0a:
+			{
+				int i = instruments.build_pulse_instrument(instr);
+				sf2.add_new_preset(name.c_str(), instrument, bank);
+				sf2.add_new_preset_bag();
+				sf2.add_new_preset_generator(SFGenerator::instrument, i);
+			}	break;
+
+			// GameBoy channel 3 instrument
+			case 0x03:
+			case 0x0b:
+			{
+				int i = instruments.build_GB3_instrument(instr);
+				sf2.add_new_preset(name.c_str(), instrument, bank);
+				sf2.add_new_preset_bag();
+				sf2.add_new_preset_generator(SFGenerator::instrument, i);
+			}	break;
+
+			// GameBoy noise instruments
+			case 0x04:
+			case 0x0c:
+			{
+				int i = instruments.build_noise_instrument(instr, key_lo, key_hi);
+				sf2.add_new_preset(name.c_str(), instrument, bank);
+				sf2.add_new_preset_bag();
+				sf2.add_new_preset_generator(SFGenerator::instrument, i);
+			}	break;
+
+			// Key split instrument
+			case 0x40:
+			{
+				int i = instruments.build_keysplit_instrument(instr, key_lo, key_hi);
+				sf2.add_new_preset(name.c_str(), instrument, bank);
+				sf2.add_new_preset_bag();
+				// Add initial attenuation preset to balance volume between sampled and GB instruments
+				add_attenuation_preset();
+				sf2.add_new_preset_generator(SFGenerator::instrument, i);
+			}	break;
+
+			// Every key split instrument
+			case 0x80:
+			{
+				int i = instruments.build_every_keysplit_instrument(instr, key_lo, key_hi);
+				sf2.add_new_preset(name.c_str(), instrument, bank);
+				sf2.add_new_preset_bag();
+				// Add initial attenuation preset to balance volume between sampled and GB instruments
+				add_attenuation_preset();
+				sf2.add_new_preset_generator(SFGenerator::instrument, i);
+			}	break;
+
+			// Ignore other instrument types
+			default:
+				break;
+		}
+
+		// If there is any error in the process just ignore it and silently continue
+		// In fact dozen of errors always happened all the times so I removed any form of error messages
+	}
+	catch (...)
+	{}
+}
@@ -0,0 +1,63 @@
+/*
+ * This file is part of GBA Sound Ripper
+ * This is free and open source software
+ *
+ * Builds a SF2 file out of sound banks of a GBA game.
+ * A builder holds all the state of one conversion (ROM, SF2 and instruments),
+ * so several SF2 files can be built at the same time, from different threads.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include "sf2.hpp"
+#include "gba_instr.hpp"
+
+class SoundFontBuilder
+{
+	GBASoundData data;
+	SF2 sf2;
+	GBAInstr instruments;
+	unsigned int main_volume;
+	bool gm_preset_names;
+
+	void add_attenuation_preset();
+
+	// Forbid copy and affectation
+	SoundFontBuilder(SoundFontBuilder&);
+	SoundFontBuilder& operator=(SoundFontBuilder&);
+
+public:
+	SoundFontBuilder(const GBASoundData& data, unsigned int sample_rate, unsigned int main_volume, bool gm_preset_names);
+
+	// Share converted samples with other builders
+	void set_pcm_cache(PcmCache *cache)
+	{
+		sf2.pcm_cache = cache;
+	}
+
+	// Convert samples on at most threads threads when the file is written, 0 for one per processor
+	// Builders running at the same time should share the processors
+	void set_threads(unsigned int threads)
+	{
+		sf2.threads = threads;
+	}
+
+	// Write samples to outfile as soon as they're converted (see SF2::stream)
+	void stream(FILE *outfile)
+	{
+		sf2.stream(outfile);
+	}
+
+	// Convert a GBA instrument of the bank graph in its SF2 preset
+	// Key split and noise instruments are only converted for keys key_lo to key_hi
+	// if any kind of error happens, it will do nothing
+	void build_instrument(const GraphInstrument& instr, unsigned int bank, unsigned int instrument, int key_lo = 0, int key_hi = 127);
+
+	// Write the SF2 file and close it
+	void write(FILE *outfile)
+	{
+		sf2.write(outfile);
+	}
+};
@@ -11,200 +11,85 @@
 #include <cstdint>
 #include <cmath>
 #include <cstring>
-#include "sf2.hpp"
-#include "gba_instr.hpp"
+#include "sound_font_builder.hpp"
+#include "pcm_cache.hpp"
+#include "song_usage.hpp"
+#include "bank_graph.hpp"
+#include "json_writer.hpp"
 #include "hex_string.hpp"
+#include <algorithm>
 #include <set>
+#include <string>
+#ifndef _WIN32
+#include <atomic>
+#include <thread>
+#include <sys/stat.h>
+#else
+#include <direct.h>
+#endif
 
 static FILE *outSF2;
+static std::string out_name;
 static FILE *out_txt = stdout;		// Log on stdout by default
 
-// Global variables
-FILE *psg_data;
-FILE *goldensun_synth;
-FILE *inGBA;
+// Data files loaded in memory
+static std::vector<uint8_t> rom_data;
+static DataView rom;
+static const char *inGBA_name;
 
 static bool verbose_flag = false;
 static bool verbose_output_to_file = false;
 static bool change_sample_rate = false;
 static bool gm_preset_names = false;
+static bool stream_flag = false;
+static bool separate_banks = false;
+static bool per_song = false;
+static const char *usage_name = nullptr;
+static const char *json_name = nullptr;
+static const char *usage_list_name = nullptr;
+static SongUsage song_usage;
 
 static unsigned int sample_rate = 22050;
 static std::set<uint32_t> addresses;
-static unsigned int current_address;
-static unsigned int current_bank;
-static unsigned int current_instrument;
+static std::vector<std::string> song_usage_names;
 static unsigned int main_volume = 15;
 
-static SF2 *sf2;
-static GBAInstr *instruments;
-
 static void print_instructions()
 {
 	puts
 	(
 		"Dumps a sound bank (or a list of sound banks) from a GBA game which is using the Sappy sound engine to SoundFont 2.0 (.sf2) format.\n"
 		"Usage: sound_font_riper [options] in.gba out.sf2 address1 [address2] ...\n"
+		"       sound_font_riper [options] -ps in.gba song1.usage [song2.usage] ...\n"
+		"       sound_font_riper [options] -ps@list.txt in.gba [song1.usage] ...\n"
 		"addresses will correspond to instrument banks in increasing order...\n"
 		"Available options :\n"
-		"-v  : Verbose; display info about the sound font in text format. If -v is followed by a file name, info is output to the specified file instead.\n"
+		"-v  : Verbose; display info about the sound font in text format. If -v is followed directly by a file name (as in -vmyfile.txt), info is output to the specified file instead.\n"
+		"-j  : JSON; -j followed by a file name (as in -jbanks.json): write the banks, instruments, envelopes, samples and waveforms to the file in JSON format.\n"
 		"-s  : Sampling rate for samples. Default: 22050 Hz\n"
 		"-gm : Give General MIDI names to presets. Note that this will only change the names and will NOT magically turn the soundfont into a General MIDI compliant soundfont.\n"
 		"-mv : Main volume for sample instruments. Range: 1-15. Game Boy channels are unnaffected.\n"
+		"-st : Stream; write samples to the output file as soon as they're converted, instead of all at once at the end.\n"
+		"-u  : Usage; -u followed by the name of a file written by song_ripper -u: only the programs and keys used by the songs are converted.\n"
+		"-sb : Separate banks; every bank is ripped to out.sf2/soundbank_NNNN/soundbank_NNNN.sf2 (out.sf2 being a directory), all at once. The directories are created if they don't exist.\n"
+		"-ps : Per song; every song.usage file written by song_ripper -u gives a song.sf2 file with only the instruments and keys of that song, all at once.\n"
+		"      -ps followed by @ and a file name (as in -ps@list.txt) also rips the usage files listed in that file, one per line, which avoids command lines too long for the system.\n"
 	);
 	exit(0);
 }
 
 
-// General MIDI instrument names
-static const char *const general_MIDI_instr_names[128] =
-{
-	"Acoustic Grand Piano", "Bright Acoustic Piano", "Electric Grand Piano", "Honky-tonk Piano", "Rhodes Piano", "Chorused Piano",
-	"Harpsichord",	"Clavinet", "Celesta", "Glockenspiel", "Music Box", "Vibraphone", "Marimba", "Xylophone", "Tubular Bells", "Dulcimer",
-	"Hammond Organ", "Percussive Organ", "Rock Organ", "Church Organ", "Reed Organ", "Accordion", "Harmonica", "Tango Accordion",
-	"Acoustic Guitar (nylon)", "Acoustic Guitar (steel)", "Electric Guitar (jazz)", "Electric Guitar (clean)", "Electric Guitar (muted)",
-	"Overdriven Guitar", "Distortion Guitar", "Guitar Harmonics", "Acoustic Bass", "Electric Bass (finger)", "Electric Bass (pick)",
-	"Fretless Bass", "Slap Bass 1", "Slap Bass 2", "Synth Bass 1", "Synth Bass 2", "Violin", "Viola", "Cello", "Contrabass",
-	"Tremelo Strings", "Pizzicato Strings", "Orchestral Harp", "Timpani", "String Ensemble 1", "String Ensemble 2", "SynthStrings 1",
-	"SynthStrings 2", "Choir Aahs", "Voice Oohs", "Synth Voice", "Orchestra Hit", "Trumpet", "Trombone", "Tuba", "Muted Trumpet",
-	"French Horn", "Brass Section", "Synth Brass 1", "Synth Brass 2", "Soprano Sax", "Alto Sax", "Tenor Sax", "Baritone Sax",
-	"Oboe", "English Horn", "Bassoon", "Clarinet", "Piccolo", "Flute", "Recorder", "Pan Flute", "Bottle Blow", "Shakuhachi", "Whistle",
-	"Ocarina", "Lead 1 (square)", "Lead 2 (sawtooth)", "Lead 3 (calliope lead)", "Lead 4 (chiff lead)", "Lead 5 (charang)",
-	"Lead 6 (voice)", "Lead 7 (fifths)", "Lead 8 (bass + lead)", "Pad 1 (new age)", "Pad 2 (warm)", "Pad 3 (polysynth)", "Pad 4 (choir)",
-	"Pad 5 (bowed)", "Pad 6 (metallic)", "Pad 7 (halo)", "Pad 8 (sweep)", "FX 1 (rain)", "FX 2 (soundtrack)", "FX 3 (crystal)",
-	"FX 4 (atmosphere)", "FX 5 (brightness)", "FX 6 (goblins)",	"FX 7 (echoes)", "FX 8 (sci-fi)", "Sitar", "Banjo", "Shamisen", "Koto",
-	"Kalimba", "Bagpipe", "Fiddle", "Shanai", "Tinkle Bell", "Agogo", "Steel Drums", "Woodblock", "Taiko Drum", "Melodic Tom",
-	"Synth Drum", "Reverse Cymbal", "Guitar Fret Noise", "Breath Noise", "Seashore", "Bird Tweet", "Telephone Ring", "Helicopter",
-	"Applause", "Gunshot"
-};
-
-// Add initial attenuation preset to balance between GameBoy and sampled instruments
-static void add_attenuation_preset()
-{
-	if (main_volume < 15)
-	{
-		const uint16_t attenuation = uint16_t(100.0 * log(15.0/main_volume));
-		sf2->add_new_preset_generator(SFGenerator::initialAttenuation, attenuation);
-	}
-}
-
-// Convert a GBA instrument in its SF2 counterpart
-// if any kind of error happens, it will do nothing and exit
-static void build_instrument(const inst_data inst)
-{
-	uint8_t instr_type = inst.word0 & 0xff;
-	std::string name;
-	if (gm_preset_names)
-		name = std::string(general_MIDI_instr_names[current_instrument]);
-	else
-		// (poetic) name of the SF2 preset...
-		name = "Type " + std::to_string(instr_type) + " @0x" + hex(current_address);
-
-	try
-	{
-		switch (instr_type)
-		{	// Sampled instrument types
-			case 0x00:
-			case 0x08:
-			case 0x10:
-			case 0x18:
-			case 0x20:
-			case 0x28:
-			case 0x30:
-			case 0x38:
-			{
-				int i = instruments->build_sampled_instrument(inst);
-				sf2->add_new_preset(name.c_str(), current_instrument, current_bank);
-				sf2->add_new_preset_bag();
-				// Add initial attenuation preset to balance volume between sampled and GB instruments
-				add_attenuation_preset();
-				sf2->add_new_preset_generator(SFGenerator::instrument, i);
-			}	break;
-
-			// GameBoy pulse wave instruments
-			case 0x01:
-			case 0x02:
-			case 0x09:
-			case 0x0a:
-			{
-				// Can only convert them if the psg_data file is found
-				if (psg_data)
-				{
-					int i = instruments->build_pulse_instrument(inst);
-					sf2->add_new_preset(name.c_str(), current_instrument, current_bank);
-					sf2->add_new_preset_bag();
-					sf2->add_new_preset_generator(SFGenerator::instrument, i);
-				}
-			}	break;
-
-			// GameBoy channel 3 instrument
-			case 0x03:
-			case 0x0b:
-			{
-				int i = instruments->build_GB3_instrument(inst);
-				sf2->add_new_preset(name.c_str(), current_instrument, current_bank);
-				sf2->add_new_preset_bag();
-				sf2->add_new_preset_generator(SFGenerator::instrument, i);
-			}	break;
-
-			// GameBoy noise instruments, not supported yet
-			case 0x04:
-			case 0x0c:
-			{
-				if (psg_data)
-				{
-					int i = instruments->build_noise_instrument(inst);
-					sf2->add_new_preset(name.c_str(), current_instrument, current_bank);
-					sf2->add_new_preset_bag();
-					sf2->add_new_preset_generator(SFGenerator::instrument, i);
-				}
-			}	break;
-
-			// Key split instrument
-			case 0x40:
-			{
-				int i = instruments->build_keysplit_instrument(inst);
-				sf2->add_new_preset(name.c_str(), current_instrument, current_bank);
-				sf2->add_new_preset_bag();
-				// Add initial attenuation preset to balance volume between sampled and GB instruments
-				add_attenuation_preset();
-				sf2->add_new_preset_generator(SFGenerator::instrument, i);
-			}	break;
-
-			// Every key split instrument
-			case 0x80:
-			{
-				int i = instruments->build_every_keysplit_instrument(inst);
-				sf2->add_new_preset(name.c_str(), current_instrument, current_bank);
-				sf2->add_new_preset_bag();
-				// Add initial attenuation preset to balance volume between sampled and GB instruments
-				add_attenuation_preset();
-				sf2->add_new_preset_generator(SFGenerator::instrument, i);
-			}	break;
-
-			// Ignore other instrument types
-			default:
-				break;
-		}
-
-		// If there is any error in the process just ignore it and silently continue
-		// In fact dozen of errors always happened all the times so I removed any form of error messages
-	}
-	catch (...)
-	{}
-}
-
 // Display verbose to console or output to file if requested
 static void print(const std::string& s)
 {
 	if (verbose_flag)
-		fprintf(out_txt, s.c_str());
+		fputs(s.c_str(), out_txt);
 }
 
 static void print(const char* s)
 {
 	if (verbose_flag)
-		fprintf(out_txt, s);
+		fputs(s, out_txt);
 }
 
 // Display ADSR values used
@@ -225,14 +110,15 @@ static void duty_cycle(int duty)
 	fprintf(out_txt, "      Duty cycle: %s\n", cycles[duty&3]);
 }
 
-// This function read instrument data and outputs info on the screen or on the verbose file
+// This function outputs info on an instrument of the bank graph on the screen or on the verbose file
 // it's not actually needed to convert the data to SF2 format, but is very useful for debugging
-static void verbose_instrument(const inst_data inst, bool recursive)
+static void verbose_instrument(const GraphInstrument& instr, bool recursive)
 {
 	// Do nothing with unused instruments
-	if (inst.word0 == 0x3c01 && inst.word1 == 0x02 && inst.word2 == 0x0F0000) return;
+	if (instr.unused()) return;
 
-	uint8_t instr_type = inst.word0 & 0xff;
+	const inst_data& inst = instr.inst;
+	uint8_t instr_type = instr.type();
 	fprintf(out_txt, "  Type: 0x%x  ", instr_type);
 	switch (instr_type)
 	{
@@ -249,19 +135,9 @@ static void verbose_instrument(const inst_data inst, bool recursive)
 			uint32_t sadr = inst.word1 & 0x3ffffff;
 			fprintf(out_txt, "(sample @0x%x)\n", sadr);
 
-			try
+			const SampleHeader& ins = instr.sample;
+			if (ins.valid)
 			{
-				if (fseek(inGBA, sadr, SEEK_SET)) throw -1;
-				struct
-				{
-					uint32_t loop;
-					uint32_t pitch;
-					uint32_t loop_pos;
-					uint32_t len;
-				}
-				ins;
-				fread(&ins, 4, 4, inGBA);
-
 				fprintf(out_txt, "      Pitch: %u\n", ins.pitch/1024);
 				fprintf(out_txt, "      Length: %u\n", ins.len);
 
@@ -276,10 +152,8 @@ static void verbose_instrument(const inst_data inst, bool recursive)
 
 				adsr(inst.word2);
 			}
-			catch (...)
-			{
+			else
 				fputs("Error: Invalid instrument\n", out_txt);
-			}
 		}	break;
 
 		// Pulse channel 1 instruments
@@ -312,38 +186,38 @@ static void verbose_instrument(const inst_data inst, bool recursive)
 			adsr(inst.word2);
 			fputs("      Waveform: ", out_txt);
 
-			try
+			if (instr.data)
 			{
-				// Seek to waveform's location
-				if (fseek(inGBA, inst.word1&0x3ffffff, SEEK_SET)) throw -1;
+				const uint8_t *wave = instr.data;
 				int waveform[32];
 
 				for (int j=0; j<16; j++)
 				{
-					uint8_t a = fgetc(inGBA);
+					uint8_t a = wave[j];
 					waveform[2*j] = a>>4;
 					waveform[2*j+1] = a & 0xF;
 				}
 
-				// Display waveform in text format
+				// Display waveform in text format, a line at a time
 				for (int j=7; j>=0; j--)
 				{
+					char line[34];
 					for (int k=0; k!=32; k++)
 					{
 						if (waveform[k] == 2*j)
-							fputc('_', out_txt);
+							line[k] = '_';
 						else if (waveform[k] == 2*j+1)
-							fputc('-', out_txt);
+							line[k] = '-';
 						else
-							fputc(' ', out_txt);
+							line[k] = ' ';
 					}
-					fputc('\n', out_txt);
+					line[32] = '\n';
+					line[33] = '\0';
+					fputs(line, out_txt);
 				}
 			}
-			catch (...)
-			{
+			else
 				fputs("Error: Invalid instrument\n", out_txt);
-			}
 		}	break;
 
 		// Noise instruments
@@ -361,51 +235,34 @@ static void verbose_instrument(const inst_data inst, bool recursive)
 		case 0x40 :
 			fputs("Key-split instrument", out_txt);
 
-			if (!recursive)
+			// Key table's location, if it's within the ROM
+			if (!recursive && instr.data)
 			{
-				bool *keys_used = new bool[128]();
-				try
+				bool keys_used[128] = {};
+				for (int k = 0; k!= 128; k++)
 				{
-				// seek to key table's location
-					if (fseek(inGBA, inst.word2&0x3ffffff, SEEK_SET)) throw -1;
-
-					for (int k = 0; k!= 128; k++)
-					{
-						uint8_t c = fgetc(inGBA);
-						if (c & 0x80) continue;		// Ignore entries with MSB set (invalid)
-						keys_used[c] = true;
-					}
-
-					int instr_table = inst.word1 & 0x3ffffff;
+					uint8_t c = instr.data[k];
+					if (c & 0x80) continue;		// Ignore entries with MSB set (invalid)
+					keys_used[c] = true;
+				}
 
-					for (int k = 0; k!= 128; k++)
+				for (int k = 0; k!= 128; k++)
+				{
+					// Decode instruments used at least once in the key table
+					if (keys_used[k])
 					{
-						// Decode instruments used at least once in the key table
-						if (keys_used[k])
+						const GraphInstrument& sub_instr = (*instr.subs)[k];
+						if (sub_instr.valid)
 						{
-							try
-							{
-								// Seek to the addressed instrument
-								if (fseek(inGBA, instr_table + 12*k, SEEK_SET)) throw -1;
-								inst_data sub_instr;
-								// Read the addressed instrument
-								fread(&sub_instr, 4, 3, inGBA);
-
-								fprintf(out_txt, "\n      Sub_intrument %d", k);
-								verbose_instrument(sub_instr, true);
-							}
-							catch (...)
-							{
-								fputs("Error: Invalid sub-instrument", out_txt);
-							}
+							fprintf(out_txt, "\n      Sub_intrument %d", k);
+							verbose_instrument(sub_instr, true);
 						}
+						else
+							fputs("Error: Invalid sub-instrument", out_txt);
 					}
 				}
-				catch (...)
-				{}
-				delete[] keys_used;
 			}
-			else
+			else if (recursive)
 				fputs("   Illegal double-recursive instrument!", out_txt);
 			break;
 
@@ -415,22 +272,16 @@ static void verbose_instrument(const inst_data inst, bool recursive)
 
 			if (!recursive)
 			{
-				uint32_t address = inst.word1 & 0x3ffffff;
 				for (int k = 0; k<128; ++k)
 				{
-					try
+					const GraphInstrument& key_instr = (*instr.subs)[k];
+					if (key_instr.valid)
 					{
-						if (fseek(inGBA, address + k*12, SEEK_SET)) throw -1;
-						inst_data key_instr;
-						fread(&key_instr, 4, 3, inGBA);
-
 						fprintf(out_txt, "\n   Key %d", k);
 						verbose_instrument(key_instr, true);
 					}
-					catch (...)
-					{
+					else
 						fputs("Error: Illegal sub-instrument", out_txt);
-					}
 				}
 			}
 			else	// Prevent instruments with multiple recursivities
@@ -445,23 +296,277 @@ static void verbose_instrument(const inst_data inst, bool recursive)
 		fprintf(out_txt, "      Key: %d, Pan: %d\n", (inst.word1>>8) & 0xFF, inst.word1>>24);
 }
 
+// JSON dump of the bank graph, the same info as the verbose output for other programs to read
+
+static void json_adsr(JsonWriter& json, uint32_t adsr)
+{
+	json.key("adsr").begin_object();
+	json.key("attack").number(adsr & 0xFF);
+	json.key("decay").number((adsr>>8) & 0xFF);
+	json.key("sustain").number((adsr>>16) & 0xFF);
+	json.key("release").number(adsr>>24);
+	json.end_object();
+}
+
+static void json_sample(JsonWriter& json, const SampleHeader& ins)
+{
+	json.key("sample");
+	if (!ins.valid)
+	{
+		json.null();
+		return;
+	}
+	json.begin_object();
+	json.key("address").number(ins.pointer);
+	json.key("pitch").number(ins.pitch);
+	json.key("length").number(ins.len);
+	json.key("loop").string(ins.loop == 0 || ins.loop == 1 ? "none" : ins.loop == 0x40000000 ? "forward" : "unknown");
+	json.key("loop_start").number(ins.loop_pos);
+	json.key("bdpcm").boolean(ins.loop == 1);
+
+	// Golden Sun synth instruments
+	if (ins.len == 0 && ins.loop_pos == 0 && ins.synth[0] == 0x80)
+	{
+		const char *const waves[3] = {"square", "saw", "triangle"};
+		json.key("synth").begin_object();
+		json.key("wave").string(ins.synth[1] < 3 ? waves[ins.synth[1]] : "unknown");
+		if (ins.synth[1] == 0)
+		{
+			json.key("duty_cycle").number(ins.synth[2]);
+			json.key("duty_cycle_speed").number(ins.synth[3]);
+		}
+		json.end_object();
+	}
+	json.end_object();
+}
+
+// Members of the JSON object of an instrument, sub-instruments don't have sub-instruments of their own
+static void json_instrument(JsonWriter& json, const GraphInstrument& instr, bool sub)
+{
+	json.key("address").number(instr.address);
+	if (!instr.valid)
+	{
+		json.key("kind").string("invalid");
+		return;
+	}
+	const inst_data& inst = instr.inst;
+	uint8_t instr_type = instr.type();
+	json.key("type").number(instr_type);
+
+	// Key and panning of the sub-instruments of every key split instruments
+	if (sub)
+	{
+		json.key("key").number((inst.word0>>8) & 0xFF);
+		json.key("pan").number(inst.word0>>24);
+	}
+
+	if (instr.unused())
+	{
+		json.key("kind").string("unused");
+		return;
+	}
+
+	switch (instr_type)
+	{
+		// Sampled instruments
+		case 0 :
+		case 8 :
+		case 0x10 :
+		case 0x18 :
+		case 0x20 :
+		case 0x28 :
+		case 0x30 :
+		case 0x38 :
+			json.key("kind").string("sample");
+			json_sample(json, instr.sample);
+			json_adsr(json, inst.word2);
+			break;
+
+		// Pulse channel 1 and 2 instruments
+		case 1 :
+		case 9 :
+		case 2 :
+		case 10 :
+		case 18 :
+			json.key("kind").string("pulse");
+			json.key("channel").number(instr_type & 1 ? 1 : 2);
+			if (instr_type & 1)
+				json.key("sweep").number(inst.word0>>24);
+			json.key("duty_cycle").number(inst.word1);
+			json_adsr(json, inst.word2);
+			break;
+
+		// Channel 3 instruments
+		case 3 :
+		case 11 :
+			json.key("kind").string("wave");
+			json.key("waveform");
+			if (instr.data)
+			{
+				json.begin_array();
+				for (int j=0; j<16; j++)
+				{
+					json.number(instr.data[j]>>4);
+					json.number(instr.data[j] & 0xF);
+				}
+				json.end_array();
+			}
+			else
+				json.null();
+			json_adsr(json, inst.word2);
+			break;
+
+		// Noise instruments
+		case 4 :
+		case 12 :
+			json.key("kind").string("noise");
+			json.key("metallic").boolean(inst.word1 != 0);
+			json_adsr(json, inst.word2);
+			break;
+
+		// Key-split instruments
+		case 0x40 :
+			json.key("kind").string("key_split");
+			if (sub) break;
+			json.key("instrument_table").number(inst.word1 & 0x3ffffff);
+			json.key("key_table").number(inst.word2 & 0x3ffffff);
+			if (!instr.data) break;
+
+			// Keys using each entry of the instrument table
+			json.key("splits").begin_array();
+			for (int key_lo = 0, key_hi; key_lo < 128; key_lo = key_hi + 1)
+			{
+				for (key_hi = key_lo; key_hi < 127 && instr.data[key_hi + 1] == instr.data[key_lo]; key_hi++);
+				json.begin_object();
+				json.key("key_lo").number(key_lo);
+				json.key("key_hi").number(key_hi);
+				json.key("index").number(instr.data[key_lo]);
+				json.end_object();
+			}
+			json.end_array();
+
+			// Instruments used at least once in the key table
+			{
+				bool keys_used[128] = {};
+				for (int k = 0; k!= 128; k++)
+					if (!(instr.data[k] & 0x80))
+						keys_used[instr.data[k]] = true;
+
+				json.key("instruments").begin_array();
+				for (int k = 0; k!= 128; k++)
+				{
+					if (!keys_used[k]) continue;
+					json.begin_object();
+					json.key("index").number(k);
+					json_instrument(json, (*instr.subs)[k], true);
+					json.end_object();
+				}
+				json.end_array();
+			}
+			break;
+
+		// Every key split instruments
+		case 0x80 :
+			json.key("kind").string("every_key_split");
+			if (sub) break;
+			json.key("instrument_table").number(inst.word1 & 0x3ffffff);
+			json.key("keys").begin_array();
+			for (int k = 0; k<128; ++k)
+			{
+				json.begin_object();
+				json_instrument(json, (*instr.subs)[k], true);
+				json.end_object();
+			}
+			json.end_array();
+			break;
+
+		default :
+			json.key("kind").string("unknown");
+			break;
+	}
+}
+
+// Write banks of the bank graph to a JSON file, they're numbered in order
+// Banks which aren't within the ROM (null) are skipped
+static void dump_json(const std::vector<const GraphBank *>& banks)
+{
+	FILE *out = fopen(json_name, "w");
+	if (!out)
+	{
+		fprintf(stderr, "Can't write to file: %s\n", json_name);
+		return;
+	}
+
+	{
+		JsonWriter json(out);
+		json.begin_object();
+		json.key("rom").string(inGBA_name);
+		json.key("banks").begin_array();
+		for (unsigned int bank = 0; bank < banks.size(); bank++)
+		{
+			if (!banks[bank]) continue;
+			json.newline();
+			json.begin_object();
+			json.key("bank").number(bank);
+			json.key("address").number(banks[bank]->address);
+			json.key("instruments").begin_array();
+			for (unsigned int instrument = 0; instrument < banks[bank]->instruments.size(); instrument++)
+			{
+				json.newline();
+				json.begin_object();
+				json.key("program").number(instrument);
+				json_instrument(json, banks[bank]->instruments[instrument], false);
+				json.end_object();
+			}
+			json.end_array();
+			json.end_object();
+		}
+		json.end_array();
+		json.end_object();
+	}
+	fputc('\n', out);
+	fclose(out);
+}
+
+// Read file names from a list file, one per line, returns false if it can't be read
+static bool load_name_list(const char *filename, std::vector<std::string>& names)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f) return false;
+
+	std::string name;
+	for (int c; (c = fgetc(f)) != EOF;)
+	{
+		if (c != '\n' && c != '\r')
+			name += char(c);
+		else if (!name.empty())
+		{
+			names.push_back(name);
+			name.clear();
+		}
+	}
+	if (!name.empty()) names.push_back(name);
+	fclose(f);
+	return true;
+}
+
 static void parse_arguments(const int argc, char *const argv[])
 {
 	if (argc == 0) print_instructions();
 	bool infile_found = false;
-	bool outfile_found = false;
+	std::vector<const char *> names;
 
 	for (int i = 0; i<argc; i++)
 	{
 		// Enable verbose if -v flag encountered in arguments list
 		if (argv[i][0] == '-')
 		{
-			if (!strcmp(argv[i], "-v"))
+			if (argv[i][1] == 'v')
 			{
 				verbose_flag = true;
 
 				// Verbose to file if a file name is given
-				if (i < argc-1 && argv[i+1][0] != '-')
+				if (argv[i][2])
 				{
 					verbose_output_to_file = true;
 					out_txt = fopen(argv[i]+2, "w");
@@ -473,6 +578,22 @@ static void parse_arguments(const int argc, char *const argv[])
 				}
 			}
 
+			else if (!strcmp(argv[i], "-st"))
+				stream_flag = true;
+
+			else if (!strcmp(argv[i], "-sb"))
+				separate_banks = true;
+
+			else if (!strcmp(argv[i], "-ps"))
+				per_song = true;
+
+			// Usage files listed in a file if -ps@ is encountered
+			else if (!strncmp(argv[i], "-ps@", 4) && argv[i][4])
+			{
+				per_song = true;
+				usage_list_name = argv[i] + 4;
+			}
+
 			// Change sampling rate if -s is encountered
 			else if (argv[i][1] == 's')
 			{
@@ -499,6 +620,14 @@ static void parse_arguments(const int argc, char *const argv[])
 			else if (!strcmp(argv[i], "-gm"))
 				gm_preset_names = true;
 
+			// Only convert what is used by songs if -u is encountered
+			else if (argv[i][1] == 'u' && argv[i][2])
+				usage_name = argv[i] + 2;
+
+			// Dump banks in JSON format if -j is encountered
+			else if (argv[i][1] == 'j' && argv[i][2])
+				json_name = argv[i] + 2;
+
 			else if (!strcmp(argv[i], "--help"))
 				print_instructions();
 		}
@@ -508,39 +637,10 @@ static void parse_arguments(const int argc, char *const argv[])
 		{
 			// Input File
 			infile_found = true;
-			inGBA = fopen(argv[i], "rb");
-			if (!inGBA)
-			{
-				fprintf(stderr, "Can't read input GBA file: %s\n", argv[0]);
-				exit(-1);
-			}
-		}
-		else if (!outfile_found)
-		{
-			outfile_found = true;
-			size_t l = strlen(argv[i]);
-			char *buffer = argv[i];
-			if (l <= 4 || strcmp(argv[i] + (l-4), ".sf2"))
-			{	// Append ".sf2" after the given file name if there isn't it already
-				buffer = new char[l+4];
-				strcpy(buffer, argv[i]);
-				strcpy(buffer + l, ".sf2");
-			}
-			outSF2 = fopen(buffer, "wb");
-			if (!outSF2)
-			{
-				fprintf(stderr, "Can't write to file: %s\n", argv[i]);
-				exit(-1);
-			}
-			if (buffer != argv[i])
-				delete[] buffer;
+			inGBA_name = argv[i];
 		}
 		else
-		{
-			uint32_t address = strtoul(argv[i], 0, 0);
-			if (!address) print_instructions();
-			addresses.insert(address);
-		}
+			names.push_back(argv[i]);
 	}
 	// Diagnostize errors/missing information
 	if (!infile_found)
@@ -548,11 +648,36 @@ static void parse_arguments(const int argc, char *const argv[])
 		fputs("An input .gba file should be given. Use --help for more information.\n", stderr);
 		exit(-1);
 	}
-	if (!outfile_found)
+
+	// Songs' usage files give everything needed to build their SF2 files
+	if (per_song)
+	{
+		song_usage_names.assign(names.begin(), names.end());
+		if (usage_list_name && !load_name_list(usage_list_name, song_usage_names))
+		{
+			fprintf(stderr, "Can't read usage list file: %s\n", usage_list_name);
+			exit(-1);
+		}
+		if (song_usage_names.empty())
+		{
+			fputs("At least one usage file should be given. Use --help for more information.\n", stderr);
+			exit(-1);
+		}
+		return;
+	}
+
+	if (names.empty())
 	{
 		fputs("An output .sf2 file should be given. Use --help for more information.\n", stderr);
 		exit(-1);
 	}
+	out_name = names[0];
+	for (size_t i = 1; i < names.size(); i++)
+	{
+		uint32_t address = strtoul(names[i], 0, 0);
+		if (!address) print_instructions();
+		addresses.insert(address);
+	}
 	if (addresses.empty())
 	{
 		fputs("At least one adress should be given for decoding. Use --help for more information.\n", stderr);
@@ -560,6 +685,166 @@ static void parse_arguments(const int argc, char *const argv[])
 	}
 }
 
+// Add leading zeroes to bank numbers
+static std::string dec4(unsigned int n)
+{
+	std::string s;
+	s += "0123456789"[n / 1000 % 10];
+	s += "0123456789"[n / 100 % 10];
+	s += "0123456789"[n / 10 % 10];
+	s += "0123456789"[n % 10];
+	return s;
+}
+
+// Programs of a bank used by songs, none if the bank isn't in the usage
+static const BankUsage *find_bank_usage(const SongUsage& usage, uint32_t address)
+{
+	static const BankUsage unused_bank;
+	SongUsage::const_iterator it = usage.find(address);
+	return it != usage.end() ? &it->second : &unused_bank;
+}
+
+// Display all instruments of a bank read in the bank graph if verbose is set
+// and build them if builder isn't null
+// Only the programs and keys of bank_usage are built if it isn't null
+static void rip_bank(SoundFontBuilder *builder, unsigned int bank, const GraphBank& graph_bank, bool verbose, const BankUsage *bank_usage)
+{
+	for (unsigned int instrument = 0; instrument < graph_bank.instruments.size(); ++instrument)
+	{
+		const GraphInstrument& instr = graph_bank.instruments[instrument];
+		if (verbose)
+			print("\nBank: " + std::to_string(bank) + ", Instrument: " + std::to_string(instrument) + " @0x" + hex(instr.address));
+
+		// Ignore unused instruments
+		if (instr.unused())
+		{
+			if (verbose) print(" (unused)");
+			continue;
+		}
+
+		if (verbose)
+			verbose_instrument(instr, false);
+
+		// Build equivalent SF2 instrument, only for the keys songs play if known
+		if (!builder) continue;
+		if (!bank_usage)
+			builder->build_instrument(instr, bank, instrument);
+		else if (bank_usage->used(instrument))
+			builder->build_instrument(instr, bank, instrument, bank_usage->key_lo[instrument], bank_usage->key_hi[instrument]);
+	}
+}
+
+// Check if an entire sound bank is within the ROM
+static bool bank_in_rom(uint32_t address, unsigned int ninstr)
+{
+	if (address <= rom.size() && ninstr*12 <= rom.size() - address) return true;
+	fprintf(stderr, "Error: Invalid position within input GBA file: 0x%x\n", address);
+	return false;
+}
+
+// Create a directory, nothing happens if it already exists
+static void make_directory(const std::string& name)
+{
+#ifdef _WIN32
+	_mkdir(name.c_str());
+#else
+	mkdir(name.c_str(), 0777);
+#endif
+}
+
+// Rip a bank to its own SF2 file, as bank 0, in its own directory
+// Returns false if it can't be ripped
+static bool rip_separate_bank(const GBASoundData& data, const BankGraph& graph, PcmCache *cache, unsigned int threads, unsigned int bank, uint32_t address)
+{
+	const GraphBank *graph_bank = graph.find_bank(address);
+	if (!graph_bank) return false;
+
+	std::string foldername = out_name + "/soundbank_" + dec4(bank);
+	make_directory(foldername);
+	std::string filename = foldername + "/soundbank_" + dec4(bank) + ".sf2";
+	FILE *out = fopen(filename.c_str(), "wb");
+	if (!out)
+	{
+		fprintf(stderr, "Can't write to file: %s\n", filename.c_str());
+		return false;
+	}
+
+	SoundFontBuilder builder(data, sample_rate, main_volume, gm_preset_names);
+	builder.set_pcm_cache(cache);
+	builder.set_threads(threads);
+	if (stream_flag) builder.stream(out);
+	rip_bank(&builder, 0, *graph_bank, false, usage_name ? find_bank_usage(song_usage, address) : nullptr);
+	builder.write(out);
+	return true;
+}
+
+// Rip the instruments used by a song to its own SF2 file, named after its usage file
+// Its banks are numbered in increasing order of address, like in a single SF2 file
+// Returns false if it can't be ripped
+static bool rip_song(const GBASoundData& data, const BankGraph& graph, PcmCache *cache, unsigned int threads, const std::string& usage_file)
+{
+	SongUsage usage;
+	if (!load_song_usage(usage_file, usage))
+	{
+		fprintf(stderr, "Can't read usage file: %s\n", usage_file.c_str());
+		return false;
+	}
+
+	size_t dot = usage_file.find_last_of('.');
+	if (dot != std::string::npos && usage_file.find_first_of("/\\", dot) != std::string::npos) dot = std::string::npos;
+	std::string filename = usage_file.substr(0, dot) + ".sf2";
+	FILE *out = fopen(filename.c_str(), "wb");
+	if (!out)
+	{
+		fprintf(stderr, "Can't write to file: %s\n", filename.c_str());
+		return false;
+	}
+
+	SoundFontBuilder builder(data, sample_rate, main_volume, gm_preset_names);
+	builder.set_pcm_cache(cache);
+	builder.set_threads(threads);
+	if (stream_flag) builder.stream(out);
+	unsigned int bank = 0;
+	for (SongUsage::const_iterator it = usage.begin(); it != usage.end(); ++it, ++bank)
+	{
+		const GraphBank *graph_bank = graph.find_bank(it->first);
+		if (graph_bank)
+			rip_bank(&builder, bank, *graph_bank, false, &it->second);
+	}
+	builder.write(out);
+	return true;
+}
+
+// Call rip(n, threads) for n = 0 to count-1, on as many threads as the CPU has
+// Each item may use threads threads of its own, so that all items together don't use more than the CPU has
+template <class Rip>
+static void rip_all(unsigned int count, Rip rip)
+{
+#ifndef _WIN32
+	unsigned int cpu_count = std::max(1u, std::thread::hardware_concurrency());
+	unsigned int thread_count = std::max(1u, std::min(cpu_count, count));
+	unsigned int item_threads = std::max(1u, cpu_count / thread_count);
+
+	// Threads take the next item to rip until there are none left
+	std::atomic<unsigned int> next(0);
+	auto rip_items = [&]()
+	{
+		for (unsigned int n; (n = next++) < count;)
+			rip(n, item_threads);
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i=1; i<thread_count; i++)
+		threads.push_back(std::thread(rip_items));
+	rip_items();
+	for (unsigned int i=0; i<threads.size(); i++)
+		threads[i].join();
+#else
+	for (unsigned int n = 0; n < count; n++)
+		rip(n, 1);
+#endif
+}
+
 int main(const int argc, char *const argv[])
 {
 	puts("GBA ROM sound font ripper (c) 2012 Bregalad");
@@ -567,32 +852,129 @@ int main(const int argc, char *const argv[])
 	// Parse arguments without the program name
 	parse_arguments(argc-1, argv+1);
 
-	// Compute prefix (path) of this program's name
-	std::string prg_name = argv[0];
-	std::string prg_prefix = prg_name.substr(0, prg_name.find("sound_font_ripper"));
+	if (usage_name && !load_song_usage(usage_name, song_usage))
+	{
+		fprintf(stderr, "Can't read usage file: %s\n", usage_name);
+		exit(-1);
+	}
 
-	// Create SF2 class
-	sf2 = new SF2(sample_rate);
-	instruments = new GBAInstr(sf2);
+	// Load input GBA file in memory, samples are converted from there
+	if (!load_file(inGBA_name, rom_data))
+	{
+		fprintf(stderr, "Can't read input GBA file: %s\n", inGBA_name);
+		exit(-1);
+	}
+	rom = DataView(rom_data);
+	GBASoundData data;
+	data.rom = rom;
+	// Banks are read once, then only read from by the builders
+	BankGraph graph(rom);
 
-	// Attempt to access psg_data file
-	psg_data = fopen((prg_prefix + "psg_data.raw").c_str(), "rb");
-	if (!psg_data)
-		puts("psg_data.raw file not found! PSG Instruments can't be dumped.");
+	if (per_song)
+	{
+		// Read the banks used by the songs
+		std::set<uint32_t> bank_list;
+		for (unsigned int i = 0; i < song_usage_names.size(); i++)
+		{
+			SongUsage usage;
+			if (!load_song_usage(song_usage_names[i], usage)) continue;
+			for (SongUsage::const_iterator it = usage.begin(); it != usage.end(); ++it)
+				bank_list.insert(it->first);
+		}
+		std::vector<const GraphBank *> graph_banks;
+		for (std::set<uint32_t>::iterator it = bank_list.begin(); it != bank_list.end(); ++it)
+			graph_banks.push_back(bank_in_rom(*it, 128) ? &graph.add_bank(*it, 128) : nullptr);
+		if (json_name) dump_json(graph_banks);
 
-	// Attempt to access goldensun_synth file
-	goldensun_synth = fopen((prg_prefix + "goldensun_synth.raw").c_str(), "rb");
-	if (!goldensun_synth)
-		puts("goldensun_synth.raw file not found! Golden Sun's synth instruments can't be dumped.");
+		// Banks used by the songs are displayed first, as songs are built all at once
+		if (verbose_flag)
+		{
+			for (unsigned int bank = 0; bank < graph_banks.size(); bank++)
+				if (graph_banks[bank])
+					rip_bank(nullptr, bank, *graph_banks[bank], true, nullptr);
+		}
 
-	// Read instrument data from input GBA file
-	inst_data *instr_data = new inst_data[128];
+		// Samples used by several songs are converted once
+		PcmCache cache;
+		std::vector<char> ripped(song_usage_names.size());
+		rip_all(song_usage_names.size(), [&](unsigned int song, unsigned int threads)
+		{
+			ripped[song] = rip_song(data, graph, &cache, threads, song_usage_names[song]);
+		});
+		if (verbose_output_to_file)
+		{
+			print("\n\n EOF");
+			fclose(out_txt);
+		}
+		unsigned int failed = std::count(ripped.begin(), ripped.end(), 0);
+		if (failed)
+		{
+			fprintf(stderr, "Error: %u of %u songs couldn't be ripped\n", failed, unsigned(ripped.size()));
+			exit(-1);
+		}
+		puts("Dump complete!\n");
+		return 0;
+	}
 
-	// Decode all banks
-	current_bank = 0;
-	for (std::set<uint32_t>::iterator it = addresses.begin(); it != addresses.end(); ++it, ++current_bank)
+	if (separate_banks)
 	{
-		current_address = *it;
+		std::vector<uint32_t> bank_list(addresses.begin(), addresses.end());
+		std::vector<const GraphBank *> graph_banks;
+		for (unsigned int bank = 0; bank < bank_list.size(); bank++)
+			graph_banks.push_back(bank_in_rom(bank_list[bank], 128) ? &graph.add_bank(bank_list[bank], 128) : nullptr);
+		if (json_name) dump_json(graph_banks);
+
+		// Banks are displayed first, as they're built all at once
+		if (verbose_flag)
+		{
+			for (unsigned int bank = 0; bank < graph_banks.size(); bank++)
+				if (graph_banks[bank])
+					rip_bank(nullptr, bank, *graph_banks[bank], true, nullptr);
+		}
+
+		// Samples used by several banks are converted once
+		// Each bank records if it's ripped in its own entry, so threads don't share any
+		make_directory(out_name);
+		PcmCache cache;
+		std::vector<char> ripped(bank_list.size());
+		rip_all(bank_list.size(), [&](unsigned int bank, unsigned int threads)
+		{
+			ripped[bank] = rip_separate_bank(data, graph, &cache, threads, bank, bank_list[bank]);
+		});
+		if (verbose_output_to_file)
+		{
+			print("\n\n EOF");
+			fclose(out_txt);
+		}
+		unsigned int failed = std::count(ripped.begin(), ripped.end(), 0);
+		if (failed)
+		{
+			fprintf(stderr, "Error: %u of %u banks couldn't be ripped\n", failed, unsigned(ripped.size()));
+			exit(-1);
+		}
+		puts("Dump complete!\n");
+		return 0;
+	}
+
+	// Append ".sf2" after the given file name if there isn't it already
+	if (out_name.size() <= 4 || out_name.compare(out_name.size() - 4, 4, ".sf2"))
+		out_name += ".sf2";
+	outSF2 = fopen(out_name.c_str(), "wb");
+	if (!outSF2)
+	{
+		fprintf(stderr, "Can't write to file: %s\n", out_name.c_str());
+		exit(-1);
+	}
+
+	// Create SF2 builder
+	SoundFontBuilder *builder = new SoundFontBuilder(data, sample_rate, main_volume, gm_preset_names);
+	if (stream_flag) builder->stream(outSF2);
+
+	// Read all banks
+	std::vector<const GraphBank *> graph_banks;
+	for (std::set<uint32_t>::iterator it = addresses.begin(); it != addresses.end(); ++it)
+	{
+		uint32_t current_address = *it;
 		std::set<uint32_t>::iterator next_it = it;
 		++next_it;
 		uint32_t next_address = *next_it;
@@ -602,36 +984,14 @@ int main(const int argc, char *const argv[])
 		if (addresses.end() != next_it && (next_address - current_address)/12 < 128)
 			ninstr = (next_address - current_address)/12;
 
-		// Seek at the start of the sound bank
-		if (fseek(inGBA, current_address, SEEK_SET) != 0
-		|| fread(instr_data, 4, ninstr*3, inGBA) != ninstr*3)				// Read entire sound bank in memory
-		{
-			fprintf(stderr, "Error: Invalid position within input GBA file: 0x%x\n", current_address);
-			exit(0);
-		}
-
-		// Decode all instruments
-		for (current_instrument = 0; current_instrument < ninstr; ++current_instrument, current_address += 12)
-		{
-			print("\nBank: " + std::to_string(current_bank) + ", Instrument: " + std::to_string(current_instrument) + " @0x" + hex(current_address));
-
-			// Ignore unused instruments
-			if (instr_data[current_instrument].word0 == 0x3c01
-			&& instr_data[current_instrument].word1 == 0x02
-			&& instr_data[current_instrument].word2 == 0x0F0000)
-			{
-				print(" (unused)");
-				continue;
-			}
-
-			if (verbose_flag)
-				verbose_instrument(instr_data[current_instrument], false);
-
-			// Build equivalent SF2 instrument
-			build_instrument(instr_data[current_instrument]);
-		}
+		if (!bank_in_rom(current_address, ninstr)) exit(0);
+		graph_banks.push_back(&graph.add_bank(current_address, ninstr));
 	}
-	delete[] instr_data;
+	if (json_name) dump_json(graph_banks);
+
+	// Decode all banks
+	for (unsigned int bank = 0; bank < graph_banks.size(); bank++)
+		rip_bank(builder, bank, *graph_banks[bank], verbose_flag, usage_name ? find_bank_usage(song_usage, graph_banks[bank]->address) : nullptr);
 
 	if (verbose_output_to_file)
 	{
@@ -641,15 +1001,8 @@ int main(const int argc, char *const argv[])
 
 	printf("Dump complete, now outputting SF2 data...");
 
-	sf2->write(outSF2);
-	delete instruments;
-	delete sf2;
-
-	// Close files
-	fclose(inGBA);
-
-	if (psg_data) fclose(psg_data);
-	if (goldensun_synth) fclose(goldensun_synth);
+	builder->write(outSF2);
+	delete builder;
 
 	puts(" Done!\n");
 	return 0;